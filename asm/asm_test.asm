@@ -1,5 +1,5 @@
 .ORIG x3000
-LEA R0, HELLO_WORLD
+LEA R0, HELLO_STR
 PUTS
 HALT
 HELLO_STR .STRINGZ "Hello World!"
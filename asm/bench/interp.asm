@@ -0,0 +1,54 @@
+; Bytecode interpreter dispatching through a jump table:
+; 0 = increment, 1 = double, 2 = print low 3 bits, 3 = end of program
+        .ORIG x3000
+        LD  R5, RUNS
+        AND R1, R1, #0
+RESTART LEA R6, PROG            ; bytecode pointer
+NEXT    LDR R2, R6, #0
+        ADD R6, R6, #1
+        LEA R3, TABLE
+        ADD R3, R3, R2
+        LDR R3, R3, #0
+        JMP R3
+OPINC   ADD R1, R1, #1
+        BRnzp NEXT
+OPDBL   ADD R1, R1, R1
+        BRnzp NEXT
+OPPRT   AND R0, R1, #7
+        LD  R4, ASCII0
+        ADD R0, R0, R4
+        JSR EMIT
+        BRnzp NEXT
+OPEND   ADD R5, R5, #-1
+        BRp RESTART
+        HALT
+EMIT    ADD R4, R5, #0          ; print on one run in 256 only
+        AND R4, R4, #15
+        BRnp SKIP
+        ADD R4, R5, #0
+        LD  R7, MASK
+        AND R4, R4, R7
+        BRnp SKIP
+        OUT
+SKIP    BRnzp NEXT
+RUNS    .FILL #20000
+MASK    .FILL xF0
+ASCII0  .FILL x30
+TABLE   .FILL OPINC
+        .FILL OPDBL
+        .FILL OPPRT
+        .FILL OPEND
+PROG    .FILL #0
+        .FILL #1
+        .FILL #0
+        .FILL #2
+        .FILL #1
+        .FILL #1
+        .FILL #0
+        .FILL #2
+        .FILL #0
+        .FILL #0
+        .FILL #1
+        .FILL #2
+        .FILL #3
+        .END
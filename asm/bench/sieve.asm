@@ -0,0 +1,47 @@
+; Sieve of Eratosthenes below N, ROUNDS times, prints the prime count mod 8
+        .ORIG x3000
+        LD  R6, ROUNDS
+ROUND   LEA R1, FLAGS           ; clear the flags
+        LD  R2, N
+CLEAR   AND R0, R0, #0
+        STR R0, R1, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp CLEAR
+        AND R3, R3, #0
+        ADD R3, R3, #2          ; i
+        AND R5, R5, #0          ; primes found
+OUTER   LD  R2, NNEG
+        ADD R2, R3, R2
+        BRzp COUNTED
+        LEA R1, FLAGS
+        ADD R1, R1, R3
+        LDR R0, R1, #0
+        BRnp NEXTI
+        ADD R5, R5, #1
+        ADD R4, R3, R3          ; j = 2i
+MARK    LD  R2, NNEG
+        ADD R2, R4, R2
+        BRzp NEXTI
+        LEA R1, FLAGS
+        ADD R1, R1, R4
+        AND R0, R0, #0
+        ADD R0, R0, #1
+        STR R0, R1, #0
+        ADD R4, R4, R3
+        BRnzp MARK
+NEXTI   ADD R3, R3, #1
+        BRnzp OUTER
+COUNTED ADD R6, R6, #-1
+        BRp ROUND
+        AND R0, R5, #7
+        LD  R1, ASCII0
+        ADD R0, R0, R1
+        OUT
+        HALT
+ROUNDS  .FILL #40
+N       .FILL #3000
+NNEG    .FILL #-3000
+ASCII0  .FILL x30
+FLAGS   .BLKW #3000
+        .END
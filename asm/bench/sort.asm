@@ -0,0 +1,56 @@
+; Insertion sort of LEN pseudo-random words, ROUNDS times, prints the smallest mod 8
+        .ORIG x3000
+        LD  R6, ROUNDS
+ROUND   LEA R1, ARR             ; fill with x = 5x + 1
+        LD  R2, LEN
+        LD  R3, SEED
+        LD  R7, MASK            ; keep keys positive, a[j-1] - key cannot overflow
+FILL    ADD R4, R3, R3
+        ADD R4, R4, R4
+        ADD R3, R3, R4
+        ADD R3, R3, #1
+        AND R4, R3, R7
+        STR R4, R1, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp FILL
+        ST  R3, SEED
+        LEA R1, ARR
+        AND R2, R2, #0
+        ADD R2, R2, #1          ; i
+ILOOP   LD  R0, LENNEG
+        ADD R0, R2, R0
+        BRzp SORTED
+        ADD R3, R1, R2          ; j = &a[i]
+        LDR R4, R3, #0          ; key
+JLOOP   NOT R0, R1
+        ADD R0, R0, #1
+        ADD R0, R3, R0
+        BRnz PLACE              ; j at the start
+        LDR R5, R3, #-1
+        NOT R0, R4
+        ADD R0, R0, #1
+        ADD R0, R5, R0          ; a[j-1] - key
+        BRnz PLACE
+        STR R5, R3, #0
+        ADD R3, R3, #-1
+        BRnzp JLOOP
+PLACE   STR R4, R3, #0
+        ADD R2, R2, #1
+        BRnzp ILOOP
+SORTED  ADD R6, R6, #-1
+        BRp ROUND
+        LDR R0, R1, #0
+        AND R0, R0, #7
+        LD  R1, ASCII0
+        ADD R0, R0, R1
+        OUT
+        HALT
+ROUNDS  .FILL #10
+LEN     .FILL #300
+LENNEG  .FILL #-300
+SEED    .FILL #12345
+MASK    .FILL x3FFF
+ASCII0  .FILL x30
+ARR     .BLKW #300
+        .END
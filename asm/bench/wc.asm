@@ -0,0 +1,22 @@
+; Counts the lines of its input, polling the keyboard registers like a
+; driver would, and prints the count mod 8 at the end of input
+        .ORIG x3000
+        AND R5, R5, #0          ; lines
+POLL    LDI R1, KBSR
+        BRzp POLL
+        LDI R0, KBDR
+        ADD R2, R0, #1
+        BRz EOF                 ; xFFFF
+        ADD R2, R0, #-10
+        BRnp POLL
+        ADD R5, R5, #1
+        BRnzp POLL
+EOF     AND R0, R5, #7
+        LD  R1, ASCII0
+        ADD R0, R0, R1
+        OUT
+        HALT
+KBSR    .FILL xFE00
+KBDR    .FILL xFE02
+ASCII0  .FILL x30
+        .END
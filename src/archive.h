@@ -0,0 +1,45 @@
+/* Indexed image archive (.tya)
+
+One file holding the images of a whole batch, written by tyvm-as:
+
+    struct tya_header
+    struct tya_entry[count]     sorted by name, so a runner can bisect it
+    names                       NUL-terminated, entry.name is an offset here
+    data                        image bytes, or the assembler error text
+
+Integers are in host byte order; the magic reads byte-swapped on a host
+of the other endianness. A runner reads the header and the index and
+then preads or maps only the images it needs. */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+
+#define TYA_MAGIC   0x41565954      // "TYVA"
+#define TYA_VERSION 1
+
+enum tya_status {
+    TYA_OK = 0,         // data is an image: big-endian origin, then words
+    TYA_ERROR           // data is the assembler message
+};
+
+struct tya_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t names_offset;
+    uint64_t data_offset;
+};
+
+struct tya_entry {
+    uint64_t source_hash;       // FNV-1a 64 of the assembler version and source
+    uint64_t offset;            // from the start of the file
+    uint32_t length;            // bytes
+    uint32_t name;              // offset into the names
+    uint32_t status;            // enum tya_status
+    uint32_t reserved;
+};
+
+#endif
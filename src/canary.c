@@ -0,0 +1,182 @@
+#include "preprocessor.h"
+#include "lc3_lib.h"
+#include "stats.h"
+#include "canary.h"
+
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static char canary_image[4096];
+static char canary_dir[4096];       // private to the sampled job, and its bundle on a mismatch
+static char canary_input[4096];
+static int canary_sampled;
+
+/* One line that two runs of the same job must agree on */
+static void write_summary(FILE* out, enum vm_exit status) {
+    fprintf(out, "exit=%s retired=%lu output=%lu:%016lx state=%016lx\n",
+            status == VM_HALT ? "halt" : status == VM_ILLEGAL ? "illegal" : "limit",
+            (unsigned long)vm_retired, (unsigned long)vm_out_len, (unsigned long)vm_out_hash, (unsigned long)vm_hash());
+}
+
+/* The summary without its retired count. A guest that polls KBSR spins
+until its input arrives, which a replay from a file never does, so for
+such runs the count is timing and not a result */
+static void drop_retired(const char* summary, char* out, size_t size) {
+    const char* field = strstr(summary, " retired=");
+    if(!field) {
+        snprintf(out, size, "%s", summary);
+        return;
+    }
+    const char* rest = field + strlen(" retired=");
+    while(*rest >= '0' && *rest <= '9') ++rest;
+    snprintf(out, size, "%.*s%s", (int)(field - summary), summary, rest);
+}
+
+static const char* env_or(const char* name, const char* fallback) {
+    const char* value = getenv(name);
+    return value && *value ? value : fallback;
+}
+
+void canary_init(const char* image) {
+#ifdef __UNIX
+    const char* fraction = getenv("TYVM_CANARY");
+    if(!fraction || !*fraction) return;
+
+    srand48((long)getpid() ^ (long)time(NULL));
+    if(drand48() >= atof(fraction)) return;
+
+    if(!realpath(image, canary_image)) return;
+
+    /* a fresh 0700 directory: nothing in it can be planted in advance */
+    snprintf(canary_dir, sizeof(canary_dir), "%s/tyvm-canary-XXXXXX", env_or("TYVM_CANARY_DIR", "/tmp"));
+    if(!mkdtemp(canary_dir)) return;
+
+    snprintf(canary_input, sizeof(canary_input), "%s/input", canary_dir);
+    vm_record = fopen(canary_input, "wb");
+    canary_sampled = vm_record != NULL;
+    if(!canary_sampled) rmdir(canary_dir);
+#endif
+}
+
+static void copy_file(const char* from, const char* to) {
+    FILE* in  = fopen(from, "rb");
+    FILE* out = fopen(to, "wb");
+    char buf[4096];
+    size_t n;
+
+    while(in && out && (n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+    if(in) fclose(in);
+    if(out) fclose(out);
+}
+
+/* Runs in the detached child: replay, compare, keep a bundle on mismatch */
+static void shadow_run(const char* summary, int polled) {
+#ifdef __UNIX
+    char ref_summary[4096];
+    snprintf(ref_summary, sizeof(ref_summary), "%s/reference.summary", canary_dir);
+
+    signal(SIGCHLD, SIG_DFL);       // a snapshot may have ignored it, but we wait for the reference
+
+    pid_t ref = fork();
+    if(ref == 0) {
+        int in  = open(canary_input, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if(in < 0 || out < 0) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+
+        /* the reference runs flat out, alone and without side channels */
+        static const char* run_only[] = {
+            "TYVM_CANARY", "TYVM_TOOLS", "TYVM_STATS", "TYVM_TIME_LIMIT", "TYVM_HZ",
+            "TYVM_IDLE", "TYVM_IDLE_HIBERNATE", "TYVM_IDLE_DIR", "TYVM_DUMP", "TYVM_DUMP_TOP",
+            "TYVM_CPU", "TYVM_BENCH_FD"
+        };
+        for(size_t i = 0; i < sizeof(run_only) / sizeof(run_only[0]); ++i) unsetenv(run_only[i]);
+        setenv("TYVM_SUMMARY", ref_summary, 1);
+
+        const char* binary = env_or("TYVM_CANARY_REF", "/proc/self/exe");
+        execl(binary, binary, canary_image, (char*)NULL);
+        _exit(127);
+    }
+
+    int wstatus = 0;
+    if(ref < 0 || waitpid(ref, &wstatus, 0) != ref) return;
+
+    char theirs[256] = "";
+    FILE* f = fopen(ref_summary, "r");
+    if(f) {
+        if(!fgets(theirs, sizeof(theirs), f)) theirs[0] = '\0';
+        fclose(f);
+    }
+
+    char ours_cmp[256], theirs_cmp[256];
+    drop_retired(summary, ours_cmp, sizeof(ours_cmp));
+    drop_retired(theirs, theirs_cmp, sizeof(theirs_cmp));
+    if(polled ? strcmp(ours_cmp, theirs_cmp) == 0 : strcmp(summary, theirs) == 0) {
+        unlink(canary_input);
+        unlink(ref_summary);
+        rmdir(canary_dir);
+        return;
+    }
+
+    /* the directory becomes the bundle: add what else the replay needs */
+    const char* bundle = canary_dir;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/run.summary", bundle);
+    if((f = fopen(path, "w"))) {
+        fputs(summary, f);
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "%s/image.obj", bundle);
+    copy_file(canary_image, path);
+
+    FILE* log = fopen(env_or("TYVM_CANARY_LOG", "tyvm-canary.log"), "a");
+    if(log) {
+        fprintf(log, "mismatch %s bundle %s\n  run       %s  reference %s%s", canary_image, bundle, summary,
+                *theirs ? theirs : "(no summary)", *theirs ? "" : "\n");
+        fclose(log);
+    }
+#endif
+}
+
+void canary_finish(enum vm_exit status) {
+    const char* summary_path = getenv("TYVM_SUMMARY");
+    if(summary_path && *summary_path) {
+        FILE* f = fopen(summary_path, "w");
+        if(f) {
+            write_summary(f, status);
+            fclose(f);
+        }
+    }
+
+#ifdef __UNIX
+    if(!canary_sampled) return;
+    fclose(vm_record);
+    vm_record = NULL;
+
+    /* a run cut short by its time limit has nothing to replay against */
+    if(status == VM_LIMIT) {
+        unlink(canary_input);
+        rmdir(canary_dir);
+        return;
+    }
+
+    char summary[256];
+    FILE* s = fmemopen(summary, sizeof(summary), "w");
+    write_summary(s, status);
+    fclose(s);
+
+    /* double fork: the job returns right away and nobody has to reap the checker */
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0) {
+        if(fork() == 0) {
+            shadow_run(summary, stats->kbd_polls != 0);
+            _exit(0);
+        }
+        _exit(0);
+    }
+    if(pid > 0) waitpid(pid, NULL, 0);
+#endif
+}
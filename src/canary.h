@@ -0,0 +1,26 @@
+/* Shadow runs on a reference interpreter
+
+With TYVM_CANARY=<fraction> that fraction of runs records its console
+input. When the run ends, a detached child replays the recording on the
+reference binary (TYVM_CANARY_REF, default this very binary with no
+tools loaded) and compares exit reason, retired instructions, console
+output and final registers and memory. A mismatch is appended to
+TYVM_CANARY_LOG and leaves a replay bundle (image, input, both
+summaries): the private tyvm-canary-XXXXXX directory the run recorded
+into, in TYVM_CANARY_DIR. A match leaves nothing behind.
+
+TYVM_SUMMARY=<file> makes any run write the summary line the comparison
+uses, which is how the reference reports back. */
+
+#ifndef CANARY_H
+#define CANARY_H
+
+#include "vm.h"
+
+/* Decide whether this run is sampled and start recording its input */
+void canary_init(const char* image);
+
+/* Write TYVM_SUMMARY and start the shadow run if this run was sampled */
+void canary_finish(enum vm_exit status);
+
+#endif
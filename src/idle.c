@@ -0,0 +1,295 @@
+#include "preprocessor.h"
+#include "registers.h"
+#include "lc3_lib.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "timer.h"
+#include "idle.h"
+
+#ifdef __UNIX
+#include <sys/stat.h>
+
+#define IDLE_PAGE       4096                            // unit of packing and of release
+#define IDLE_LITERALS   128                             // longest literal run
+#define IDLE_MIN_MATCH  4
+#define IDLE_MAX_MATCH  (IDLE_MIN_MATCH + 127)
+#define IDLE_HASH_BITS  12
+#define IDLE_BOUND      (IDLE_PAGE + IDLE_PAGE / IDLE_LITERALS + 1)
+
+/* Everything the guest dirties at run time */
+static const struct {
+    void* base;
+    size_t size;
+} idle_regions[] = {
+    { memory, sizeof(memory) },
+    { block_hits, sizeof(block_hits) },
+};
+#define IDLE_REGIONS ((int)(sizeof(idle_regions) / sizeof(idle_regions[0])))
+
+/* One page in the packed state, followed by its stored bytes. Pages that
+are all zero are left out: released, they read back as zero anyway. */
+struct idle_chunk {
+    uint32_t offset;            // from the region base
+    uint16_t size;              // bytes in the region
+    uint16_t stored;            // bytes that follow
+    uint8_t region;
+    uint8_t raw;                // stored as is, packing did not pay
+    uint8_t reserved[2];
+};
+
+static int idle_timed;                  // stdin is unbuffered, waits go through timer_wait()
+static double idle_after;               // seconds before packing, 0 = never
+static double idle_hibernate_after;     // seconds after packing before hibernating, 0 = never
+static char idle_template[4096];       // for mkstemp, one fresh file per hibernation
+static char idle_path[4096];
+
+static uint8_t* idle_packed;            // the packed state while in IT_PACKED
+static size_t idle_packed_len;
+
+/* Byte-oriented LZ77: a control byte c < 0x80 is followed by c + 1
+literals; c >= 0x80 copies (c & 0x7F) + IDLE_MIN_MATCH bytes from a
+16-bit little-endian distance back, overlapping for runs */
+static size_t idle_pack_page(const uint8_t* in, size_t n, uint8_t* out) {
+    uint16_t table[1 << IDLE_HASH_BITS] = {0};     // position + 1 of the last 4 bytes with this hash
+    size_t len = 0, i = 0, literal = 0;
+
+    while(i + IDLE_MIN_MATCH <= n) {
+        uint32_t v;
+        memcpy(&v, in + i, sizeof(v));
+        const uint32_t h = (v * 2654435761u) >> (32 - IDLE_HASH_BITS);
+        const size_t candidate = table[h];
+        table[h] = (uint16_t)(i + 1);
+
+        if(!candidate || memcmp(in + candidate - 1, in + i, IDLE_MIN_MATCH) != 0) {
+            ++i;
+            continue;
+        }
+
+        const size_t from = candidate - 1;
+        size_t match = IDLE_MIN_MATCH;
+        while(i + match < n && match < IDLE_MAX_MATCH && in[from + match] == in[i + match]) ++match;
+
+        while(literal < i) {
+            const size_t run = i - literal < IDLE_LITERALS ? i - literal : IDLE_LITERALS;
+            out[len++] = (uint8_t)(run - 1);
+            memcpy(out + len, in + literal, run);
+            len += run;
+            literal += run;
+        }
+
+        const size_t distance = i - from;
+        out[len++] = (uint8_t)(0x80 | (match - IDLE_MIN_MATCH));
+        out[len++] = (uint8_t)distance;
+        out[len++] = (uint8_t)(distance >> 8);
+        i += match;
+        literal = i;
+    }
+
+    while(literal < n) {
+        const size_t run = n - literal < IDLE_LITERALS ? n - literal : IDLE_LITERALS;
+        out[len++] = (uint8_t)(run - 1);
+        memcpy(out + len, in + literal, run);
+        len += run;
+        literal += run;
+    }
+    return len;
+}
+
+static int idle_unpack_page(const uint8_t* in, size_t n, uint8_t* out, size_t size) {
+    size_t i = 0, o = 0;
+    while(i < n) {
+        const uint8_t c = in[i++];
+        if(c < 0x80) {
+            if(i + c + 1 > n || o + c + 1 > size) return FALSE;
+            memcpy(out + o, in + i, c + 1);
+            i += c + 1;
+            o += c + 1;
+            continue;
+        }
+
+        if(i + 2 > n) return FALSE;
+        const size_t match = (c & 0x7F) + IDLE_MIN_MATCH;
+        const size_t distance = in[i] | in[i + 1] << 8;
+        i += 2;
+        if(distance == 0 || distance > o || o + match > size) return FALSE;
+        for(size_t k = 0; k < match; ++k, ++o) out[o] = out[o - distance];
+    }
+    return o == size;
+}
+
+static int all_zero(const uint8_t* p, size_t n) {
+    for(size_t i = 0; i < n; ++i)
+        if(p[i]) return FALSE;
+    return TRUE;
+}
+
+/* Pack every non-zero page, then release the pages wholly inside a region */
+static void idle_pack(void) {
+    size_t bound = 0;
+    for(int r = 0; r < IDLE_REGIONS; ++r)
+        bound += (idle_regions[r].size / IDLE_PAGE + 2) * (sizeof(struct idle_chunk) + IDLE_BOUND);
+
+    /* large enough to be mmapped: the untouched tail never becomes
+    resident, and the shrinking realloc gives it back */
+    uint8_t* buf = malloc(bound);
+    if(!buf) return;
+
+    size_t len = 0;
+    for(int r = 0; r < IDLE_REGIONS; ++r) {
+        uint8_t* base = idle_regions[r].base;
+        const size_t size = idle_regions[r].size;
+
+        for(size_t offset = 0; offset < size; ) {
+            /* pages follow the absolute alignment, so the ones released are whole */
+            size_t end = ((uintptr_t)(base + offset) / IDLE_PAGE + 1) * IDLE_PAGE - (uintptr_t)base;
+            if(end > size) end = size;
+
+            if(!all_zero(base + offset, end - offset)) {
+                struct idle_chunk chunk = { (uint32_t)offset, (uint16_t)(end - offset), 0, (uint8_t)r, FALSE, {0} };
+                uint8_t* data = buf + len + sizeof(chunk);
+
+                chunk.stored = (uint16_t)idle_pack_page(base + offset, chunk.size, data);
+                if(chunk.stored >= chunk.size) {
+                    memcpy(data, base + offset, chunk.size);
+                    chunk.stored = chunk.size;
+                    chunk.raw = TRUE;
+                }
+                memcpy(buf + len, &chunk, sizeof(chunk));
+                len += sizeof(chunk) + chunk.stored;
+            }
+            offset = end;
+        }
+    }
+
+    for(int r = 0; r < IDLE_REGIONS; ++r) {
+        const uintptr_t start = ((uintptr_t)idle_regions[r].base + IDLE_PAGE - 1) / IDLE_PAGE * IDLE_PAGE;
+        const uintptr_t end = ((uintptr_t)idle_regions[r].base + idle_regions[r].size) / IDLE_PAGE * IDLE_PAGE;
+        if(end > start) madvise((void*)start, end - start, MADV_DONTNEED);
+    }
+
+    uint8_t* shrunk = realloc(buf, len ? len : 1);
+    idle_packed = shrunk ? shrunk : buf;
+    idle_packed_len = len;
+
+    stats->idle_tier = IT_PACKED;
+    stats->idle_packs++;
+    stats->idle_packed_bytes = len;
+}
+
+/* Move the packed state to the hibernation file; stays packed in memory if that fails */
+static void idle_hibernate(void) {
+    snprintf(idle_path, sizeof(idle_path), "%s", idle_template);
+    int fd = mkstemp(idle_path);        // never a name someone could have planted
+    if(fd < 0) return;
+
+    size_t done = 0;
+    for(ssize_t n; done < idle_packed_len && (n = write(fd, idle_packed + done, idle_packed_len - done)) > 0; ) done += n;
+    if(close(fd) != 0 || done != idle_packed_len) {
+        unlink(idle_path);
+        return;
+    }
+
+    free(idle_packed);
+    idle_packed = NULL;
+    stats->idle_tier = IT_HIBERNATED;
+    stats->idle_hibernations++;
+}
+
+static void idle_fail(const char* what) {
+    release_terminal();
+    stats_close();
+    fprintf(stderr, "tyvm: cannot resume a parked VM: %s\n", what);
+    exit(1);
+}
+
+/* Bring the state back, from the file if hibernated */
+static void idle_restore(void) {
+    if(stats->idle_tier == IT_HIBERNATED) {
+        idle_packed = malloc(idle_packed_len ? idle_packed_len : 1);
+        int fd = open(idle_path, O_RDONLY);
+        if(!idle_packed || fd < 0) idle_fail(idle_path);
+
+        size_t done = 0;
+        for(ssize_t n; done < idle_packed_len && (n = read(fd, idle_packed + done, idle_packed_len - done)) > 0; ) done += n;
+        close(fd);
+        unlink(idle_path);
+        if(done != idle_packed_len) idle_fail(idle_path);
+    }
+
+    for(size_t pos = 0; pos < idle_packed_len; ) {
+        struct idle_chunk chunk;
+        memcpy(&chunk, idle_packed + pos, sizeof(chunk));
+        pos += sizeof(chunk);
+
+        uint8_t* dest = (uint8_t*)idle_regions[chunk.region].base + chunk.offset;
+        if(chunk.raw) memcpy(dest, idle_packed + pos, chunk.size);
+        else if(!idle_unpack_page(idle_packed + pos, chunk.stored, dest, chunk.size)) idle_fail("corrupt packed page");
+        pos += chunk.stored;
+    }
+
+    free(idle_packed);
+    idle_packed = NULL;
+    stats->idle_tier = IT_AWAKE;
+}
+
+/* Packs after TYVM_IDLE, hibernates after TYVM_IDLE_HIBERNATE more */
+static void idle_fire(struct vm_timer* t) {
+    if(stats->idle_tier == IT_AWAKE) {
+        idle_pack();
+        if(stats->idle_tier == IT_PACKED && idle_hibernate_after > 0) timer_arm(t, (uint64_t)(idle_hibernate_after * 1e9));
+    } else if(stats->idle_tier == IT_PACKED) idle_hibernate();
+}
+
+static struct vm_timer idle_timer = { .fire = idle_fire };
+#endif
+
+void idle_init(void) {
+#ifdef __UNIX
+    const char* after = getenv("TYVM_IDLE");
+    idle_after = after ? atof(after) : 0;
+
+    /* waits always poll, so that SIGUSR1 can dump a VM parked on input */
+    struct stat st;
+    if(fstat(STDIN_FILENO, &st) != 0 || S_ISREG(st.st_mode)) return;    // a file is always ready
+
+    setvbuf(stdin, NULL, _IONBF, 0);
+    idle_timed = TRUE;
+    if(idle_after <= 0) return;
+
+    const char* hibernate = getenv("TYVM_IDLE_HIBERNATE");
+    const char* dir = getenv("TYVM_IDLE_DIR");
+    idle_hibernate_after = hibernate ? atof(hibernate) : 0;
+    snprintf(idle_template, sizeof(idle_template), "%s/tyvm-%d.idle.XXXXXX", dir && *dir ? dir : "/tmp", (int)getpid());
+    if(idle_hibernate_after > 0) arm_interrupt();   // a killed VM removes its file
+#endif
+}
+
+int idle_wait(void) {
+#ifdef __UNIX
+    if(!idle_timed || vm_in != stdin) return TRUE;
+    acquire_terminal();             // raw mode first, or poll waits for a whole line
+
+    if(idle_after > 0) timer_arm(&idle_timer, (uint64_t)(idle_after * 1e9));
+    int ready;
+    while((ready = timer_wait(fileno(stdin))) == TIMER_SIGNALLED) {
+        if(!snapshot_pending) continue;
+        if(stats->idle_tier != IT_AWAKE) {      // dump the real pages, and pack them again later
+            idle_restore();
+            timer_arm(&idle_timer, (uint64_t)(idle_after * 1e9));
+        }
+        take_snapshot();
+    }
+    timer_cancel(&idle_timer);
+
+    if(stats->idle_tier != IT_AWAKE) idle_restore();
+    return ready;
+#else
+    return TRUE;
+#endif
+}
+
+void idle_close(void) {
+#ifdef __UNIX
+    if(stats->idle_tier == IT_HIBERNATED) unlink(idle_path);
+#endif
+}
@@ -0,0 +1,31 @@
+/* Memory reclamation for a VM parked in GETC/IN
+
+An interactive guest spends most of its life waiting for a human, with
+its whole state resident. With TYVM_IDLE set to a number of seconds, a
+blocking read that has waited that long packs the dirty pages (guest
+memory and block counters) into one buffer with a small LZ codec and
+hands the pages back to the kernel. After TYVM_IDLE_HIBERNATE more
+seconds the buffer goes to a file in TYVM_IDLE_DIR (default /tmp) and
+is freed as well. Both deadlines are timers on the wheel in timer.h,
+and the wait is a poll() on stdin and the timerfd. Input wakes the
+VM: the pages are unpacked in place before the read returns, so the
+guest never notices.
+
+Only a terminal or a pipe parks; a file on stdin is always ready. */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+/* Read the TYVM_IDLE settings. Unless stdin is a file, it is made
+unbuffered so that poll() sees every byte the guest has not read yet:
+a wait can end on a timer, or on SIGUSR1 to take a snapshot. */
+void idle_init(void);
+
+/* Block until the guest input is readable, reclaiming memory meanwhile;
+FALSE when a timer stopped the VM instead (see timer.h) */
+int idle_wait(void);
+
+/* Remove the hibernation file, for exits while parked */
+void idle_close(void);
+
+#endif
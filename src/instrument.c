@@ -0,0 +1,118 @@
+#include "preprocessor.h"
+#include "registers.h"
+#include "instrument.h"
+
+/* static builds (make static) cannot dlopen, tools need the dynamic one */
+#if defined(__UNIX) && !defined(TYVM_STATIC)
+    #define TYVM_DLOPEN
+    #include <dlfcn.h>
+#endif
+
+#define MAX_TOOLS 16
+
+unsigned instrument_mask;
+
+static struct tyvm_tool tools[MAX_TOOLS];
+static int tool_count;
+
+/* Load one TYVM_TOOLS entry, "path" or "path=args" */
+static int load_tool(char* entry) {
+#ifdef TYVM_DLOPEN
+    if(tool_count == MAX_TOOLS) {
+        fprintf(stderr, "tyvm: too many tools, at most %d\n", MAX_TOOLS);
+        return 0;
+    }
+
+    char* args = strchr(entry, '=');
+    if(args) *args++ = '\0';
+
+    void* so = dlopen(entry, RTLD_NOW | RTLD_LOCAL);
+    if(!so) {
+        fprintf(stderr, "tyvm: cannot load tool %s: %s\n", entry, dlerror());
+        return 0;
+    }
+
+    int (*init)(struct tyvm_tool*) = (int (*)(struct tyvm_tool*))dlsym(so, "tyvm_tool_init");
+    if(!init) {
+        fprintf(stderr, "tyvm: %s does not export tyvm_tool_init\n", entry);
+        return 0;
+    }
+
+    struct tyvm_tool* tool = &tools[tool_count];
+    tool->api    = TYVM_TOOL_API;
+    tool->args   = args ? args : "";
+    tool->memory = memory;
+    tool->reg    = reg;
+    tool->pc_lo  = 0;
+    tool->pc_hi  = UINT16_MAX;
+
+    if(!init(tool)) {
+        fprintf(stderr, "tyvm: tool %s refused to load\n", entry);
+        return 0;
+    }
+    tool_count++;
+
+    if(tool->on_block)     instrument_mask |= HOOK_BLOCK;
+    if(tool->on_insn)      instrument_mask |= HOOK_INSN;
+    if(tool->on_mem_read)  instrument_mask |= HOOK_MEM_READ;
+    if(tool->on_mem_write) instrument_mask |= HOOK_MEM_WRITE;
+    if(tool->on_branch)    instrument_mask |= HOOK_BRANCH;
+    if(tool->on_trap)      instrument_mask |= HOOK_TRAP;
+    if(tool->on_exit)      instrument_mask |= HOOK_EXIT;
+    return 1;
+#else
+    fprintf(stderr, "tyvm: tools need the dynamically linked Unix build\n");
+    return 0;
+#endif
+}
+
+int instrument_init(void) {
+    const char* list = getenv("TYVM_TOOLS");
+    if(!list || !*list) return 1;
+
+    char* copy = strdup(list);      // tool args point into it, never freed
+    for(char* entry = strtok(copy, ":"); entry; entry = strtok(NULL, ":"))
+        if(!load_tool(entry)) return 0;
+    return 1;
+}
+
+void instrument_block(uint16_t pc) {
+    for(int i = 0; i < tool_count; ++i)
+        if(tools[i].on_block && pc >= tools[i].pc_lo && pc <= tools[i].pc_hi) tools[i].on_block(&tools[i], pc);
+}
+
+void instrument_insn(uint16_t pc, uint16_t instr) {
+    for(int i = 0; i < tool_count; ++i)
+        if(tools[i].on_insn && pc >= tools[i].pc_lo && pc <= tools[i].pc_hi) tools[i].on_insn(&tools[i], pc, instr);
+}
+
+void instrument_mem_read(uint16_t address, uint16_t val) {
+    for(int i = 0; i < tool_count; ++i)
+        if(tools[i].on_mem_read) tools[i].on_mem_read(&tools[i], address, val);
+}
+
+void instrument_mem_write(uint16_t address, uint16_t val) {
+    for(int i = 0; i < tool_count; ++i)
+        if(tools[i].on_mem_write) tools[i].on_mem_write(&tools[i], address, val);
+}
+
+void instrument_control(uint16_t pc, uint16_t instr) {
+    const uint16_t next = reg[RG_PC];
+
+    if((instr >> 12) == OP_TRAP) {
+        if(instrument_mask & HOOK_TRAP)
+            for(int i = 0; i < tool_count; ++i)
+                if(tools[i].on_trap) tools[i].on_trap(&tools[i], pc, instr & 0xFF);
+    } else if(instrument_mask & HOOK_BRANCH) {
+        const int taken = next != (uint16_t)(pc + 1);
+        for(int i = 0; i < tool_count; ++i)
+            if(tools[i].on_branch) tools[i].on_branch(&tools[i], pc, next, taken);
+    }
+
+    if((instrument_mask & HOOK_BLOCK) && instr != (OP_TRAP << 12 | TC_HALT)) instrument_block(next);
+}
+
+void instrument_exit(void) {
+    for(int i = 0; i < tool_count; ++i)
+        if(tools[i].on_exit) tools[i].on_exit(&tools[i]);
+}
@@ -0,0 +1,37 @@
+/* VM side of the instrumentation API (see tyvm_tool.h) */
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include "tyvm_tool.h"
+
+/* Events at least one loaded tool listens to */
+enum hooks {
+    HOOK_BLOCK     = 1 << 0,
+    HOOK_INSN      = 1 << 1,
+    HOOK_MEM_READ  = 1 << 2,
+    HOOK_MEM_WRITE = 1 << 3,
+    HOOK_BRANCH    = 1 << 4,
+    HOOK_TRAP      = 1 << 5,
+    HOOK_EXIT      = 1 << 6
+};
+
+/* Zero when no tool is loaded, the only thing the hot loop tests */
+extern unsigned instrument_mask;
+
+/* Load the tools listed in TYVM_TOOLS, 0 if one of them failed */
+int instrument_init(void);
+
+/* Dispatch functions, only called when the matching hook bit is set */
+void instrument_block(uint16_t pc);
+void instrument_insn(uint16_t pc, uint16_t instr);
+void instrument_mem_read(uint16_t address, uint16_t val);
+void instrument_mem_write(uint16_t address, uint16_t val);
+
+/* Branch/trap and block entry events after a block-ending instruction at pc */
+void instrument_control(uint16_t pc, uint16_t instr);
+
+/* Run the on_exit callbacks */
+void instrument_exit(void);
+
+#endif
@@ -1,23 +1,9 @@
-#include "preprocessor.c"
+#include "preprocessor.h"
 #include "lc3_lib.h"
-#include "registers.c"
-
-uint16_t sign_extend(uint16_t n, int bit_count) {
-    if((n >> (bit_count - 1)) & 1) {
-        n |= (0xFFFF << bit_count);
-    }
-    return n;
-}
-
-int swap16(uint16_t x) {
-    return (x << 8) || (x >> 8);
-}
-
-void update_flags(uint16_t r) {
-    if(reg[r] == 0) reg[RG_COND] = FL_Z;
-    else if(reg[r] >> 15) reg[RG_COND] = FL_N;
-    else reg[RG_COND] = FL_P;
-}
+#include "registers.h"
+#include "stats.h"
+#include "instrument.h"
+#include "idle.h"
 
 /* function to load assembly programs*/
 void read_image_file(FILE* file) {
@@ -38,22 +24,36 @@ void read_image_file(FILE* file) {
 }
 
 int read_image(const char* file) {
-    FILE* image= fopen(file,"rb");
-    if(!image){
+#ifdef __UNIX
+    /* straight into place with read(): no stdio buffer, and the pages
+    past the image stay untouched demand-zero memory */
+    int fd = open(file, O_RDONLY);
+    if(fd < 0) return 0;
+
+    uint16_t origin;
+    if(read(fd, &origin, sizeof(origin)) != sizeof(origin)) {
+        close(fd);
         return 0;
     }
-    uint16_t origin;
-    fread(&origin,sizeof(origin),1,image);
     origin = swap16(origin);
-    uint16_t max_read = UINT16_MAX - origin;
+
     uint16_t* i = memory + origin;
-    size_t read = fread(i,sizeof(uint16_t),max_read,image);
+    size_t want = (UINT16_MAX - origin) * sizeof(uint16_t);
+    size_t got = 0;
+    for(ssize_t n; got < want && (n = read(fd, (char*)i + got, want - got)) > 0; ) got += n;
+    close(fd);
 
-    while(read-- > 0){
-        *i = swap16(*i);
-        ++i;
+    for(size_t words = got / sizeof(uint16_t); words-- > 0; ++i) *i = swap16(*i);
+    return 1;
+#else
+    FILE* image= fopen(file,"rb");
+    if(!image){
+        return 0;
     }
+    read_image_file(image);
+    fclose(image);
     return 1;
+#endif
 }
 
 /* Defining OS-dependent functions for Unix or Windows based systems */
@@ -67,6 +67,7 @@ int read_image(const char* file) {
     timeout.tv_sec = 0;
     timeout.tv_usec = 0;
     return select(1, &readfds, NULL, NULL, &timeout) != 0;
+    }
 
     struct termios original_tio;
 
@@ -80,8 +81,13 @@ int read_image(const char* file) {
     void restore_input_buffering() {
         tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
     }
-}
+
+    static int is_terminal(void) {
+        return isatty(STDIN_FILENO);
+    }
 #else
+    HANDLE hStdin = INVALID_HANDLE_VALUE;
+
     uint16_t check_key() {
         return WaitForSingleObject(hStdin, 1000) == WAIT_OBJECT_0 && _kbhit();
     }
@@ -101,17 +107,97 @@ int read_image(const char* file) {
     void restore_input_buffering() {
         SetConsoleMode(hStdin, fdwOldMode);
     }
+
+    static int is_terminal(void) {
+        return _isatty(_fileno(stdin));
+    }
 #endif
 
+/* Terminal set up on first guest input rather than at startup: short jobs
+that never read pay for neither the terminal ioctls nor the handlers */
+enum terminal_state {
+    TS_UNTOUCHED = 0,
+    TS_NOT_TTY,             // stdin is a file or a pipe, nothing to change
+    TS_RAW                  // input buffering disabled, restore on exit
+};
+
+static enum terminal_state terminal_state;
+static int interrupt_armed;
+
+void arm_interrupt(void) {
+    if(interrupt_armed) return;
+    signal(SIGINT, handle_interrupt);
+    signal(SIGTERM, handle_interrupt);
+    interrupt_armed = TRUE;
+}
+
+void acquire_terminal(void) {
+    if(terminal_state != TS_UNTOUCHED) return;
+    if(!is_terminal()) {
+        terminal_state = TS_NOT_TTY;
+        return;
+    }
+    arm_interrupt();
+    disable_input_buffering();
+    terminal_state = TS_RAW;
+}
+
+void release_terminal(void) {
+    if(terminal_state == TS_RAW) restore_input_buffering();
+    terminal_state = TS_UNTOUCHED;
+}
+
+FILE* vm_in;
+FILE* vm_out;
+FILE* vm_record;
+uint64_t vm_out_len;
+uint64_t vm_out_hash = 0xCBF29CE484222325u;
+
+int vm_getc(void) {
+    if(vm_in == stdin && terminal_state == TS_UNTOUCHED) acquire_terminal();
+    const int c = getc(vm_in);
+    if(vm_record && c != EOF) putc(c, vm_record);
+    return c;
+}
+
+void vm_putc(char c) {
+    putc(c, vm_out);
+    vm_out_len++;
+    vm_out_hash = (vm_out_hash ^ (uint8_t)c) * 0x100000001B3u;
+}
+
+void vm_puts(const char* s) {
+    while(*s) vm_putc(*s++);
+}
+
+void vm_count_out(const char* s) {
+    for(; *s; ++s) {
+        vm_out_len++;
+        vm_out_hash = (vm_out_hash ^ (uint8_t)*s) * 0x100000001B3u;
+    }
+}
+
 void mem_write(uint16_t address, uint16_t val) {
+    stats->mem_writes++;
+    if(instrument_mask & HOOK_MEM_WRITE) instrument_mem_write(address, val);
     memory[address] = val;
 }
 
 int mem_read(uint16_t address) {
+    const uint16_t val = mem_fetch(address);
+    if(instrument_mask & HOOK_MEM_READ) instrument_mem_read(address, val);
+    return val;
+}
+
+uint16_t mem_fetch(uint16_t address) {
+    stats->mem_reads++;
     if(address == MR_KSR) {
-        if(check_key()) {
+        stats->kbd_polls++;
+        if(vm_in == stdin && terminal_state == TS_UNTOUCHED) acquire_terminal();
+        if(vm_in != stdin || check_key()) {    // input from a file is always ready
+            stats->kbd_hits++;
             memory[MR_KSR] = 1 << 15;
-            memory[MR_KDR] = getchar();
+            memory[MR_KDR] = vm_getc();
         } else memory[MR_KSR] = 0;
     }
 
@@ -119,7 +205,9 @@ int mem_read(uint16_t address) {
 }
 
 void handle_interrupt(int signal) {
-    restore_input_buffering();
+    release_terminal();
+    idle_close();
+    stats_close();
     printf("\n");
     exit(-2);
 }
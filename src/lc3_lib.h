@@ -1,17 +1,35 @@
 /* Library of functions used in tyvm.c */
 
-#include "preprocessor.c"
+#ifndef LC3_LIB_H
+#define LC3_LIB_H
+
+#include "preprocessor.h"
+#include "registers.h"
+
+/* The helpers below run for nearly every guest instruction; they are
+defined here so vm.c can inline them */
 
 /* Sign extension function for immediate add mode (imm5[0:4])
 transforms 5bit number to 8bit number preserving sign*/
-uint16_t sign_extend(uint16_t n, int bit_count);
+static inline uint16_t sign_extend(uint16_t n, int bit_count) {
+    if((n >> (bit_count - 1)) & 1) {
+        n |= (0xFFFF << bit_count);
+    }
+    return n;
+}
 
 /* Swap to big endian */
-int swap16(uint16_t x);
+static inline int swap16(uint16_t x) {
+    return (uint16_t)((x << 8) | (x >> 8));
+}
 
 /* Flag update function
 Every time a value is written to a register the flag will be updated */
-void update_flags(uint16_t r);
+static inline void update_flags(uint16_t r) {
+    if(reg[r] == 0) reg[RG_COND] = FL_Z;
+    else if(reg[r] >> 15) reg[RG_COND] = FL_N;
+    else reg[RG_COND] = FL_P;
+}
 
 /* Load assembly file*/
 void read_image_file(FILE* file);
@@ -23,14 +41,46 @@ int read_image(const char* file);
 void disable_input_buffering();
 void restore_input_buffering();
 
+/* Disable input buffering the first time the guest reads a terminal,
+and restore it on exit if that happened */
+void acquire_terminal(void);
+void release_terminal(void);
+
+/* Install the SIGINT/SIGTERM cleanup handlers, once */
+void arm_interrupt(void);
+
 /* check key - unix or win */
 uint16_t check_key();
 
+/* Guest console streams, NULL means stdin/stdout */
+extern FILE* vm_in;
+extern FILE* vm_out;
+
+/* When set, every byte the guest reads is copied here */
+extern FILE* vm_record;
+
+/* Length and FNV-1a hash of everything the guest wrote */
+extern uint64_t vm_out_len;
+extern uint64_t vm_out_hash;
+
+/* Guest console I/O through vm_in/vm_out */
+int vm_getc(void);
+void vm_putc(char c);
+void vm_puts(const char* s);
+
+/* Count text already written to vm_out by hand in its length and hash */
+void vm_count_out(const char* s);
+
 /* Write to memory address */
 void mem_write(uint16_t address, uint16_t val);
 
 /* Read memory address */
 int mem_read(uint16_t address);
 
+/* Read memory address for an instruction fetch, not reported to tools as a data read */
+uint16_t mem_fetch(uint16_t address);
+
 /* Handle interrupt */
 void handle_interrupt(int signal);
+
+#endif
@@ -0,0 +1,426 @@
+#include "preprocessor.h"
+#include "registers.h"
+#include "lc3as.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <strings.h>
+
+#define AS_MAX_TOKENS   8
+#define AS_MAX_LINE     1024
+#define AS_LABEL_LEN    64
+
+/* What a mnemonic assembles to */
+enum as_kind {
+    AK_ADD = 0,     // ADD, AND
+    AK_NOT,
+    AK_BR,
+    AK_JMP,         // JMP, JSRR
+    AK_RET,
+    AK_JSR,
+    AK_LOAD,        // LD, LDI, LEA, ST, STI: register, PCoffset9
+    AK_BASE,        // LDR, STR: register, base register, offset6
+    AK_TRAP,
+    AK_FIXED,       // RTI and the trap aliases, no operands
+    AK_ORIG,
+    AK_FILL,
+    AK_BLKW,
+    AK_STRINGZ,
+    AK_END
+};
+
+struct as_mnemonic {
+    const char* name;
+    enum as_kind kind;
+    uint16_t bits;
+};
+
+static const struct as_mnemonic mnemonics[] = {
+    { "ADD",      AK_ADD,     OP_ADD << 12 },
+    { "AND",      AK_ADD,     OP_AND << 12 },
+    { "NOT",      AK_NOT,     OP_NOT << 12 | 0x3F },
+    { "JMP",      AK_JMP,     OP_JMP << 12 },
+    { "JSRR",     AK_JMP,     OP_JSR << 12 },
+    { "RET",      AK_RET,     OP_JMP << 12 | RG_R7 << 6 },
+    { "JSR",      AK_JSR,     OP_JSR << 12 | 1 << 11 },
+    { "LD",       AK_LOAD,    OP_LD  << 12 },
+    { "LDI",      AK_LOAD,    OP_LDI << 12 },
+    { "LEA",      AK_LOAD,    OP_LEA << 12 },
+    { "ST",       AK_LOAD,    OP_ST  << 12 },
+    { "STI",      AK_LOAD,    OP_STI << 12 },
+    { "LDR",      AK_BASE,    OP_LDR << 12 },
+    { "STR",      AK_BASE,    OP_STR << 12 },
+    { "TRAP",     AK_TRAP,    OP_TRAP << 12 },
+    { "RTI",      AK_FIXED,   OP_RTI << 12 },
+    { "GETC",     AK_FIXED,   OP_TRAP << 12 | TC_GETC },
+    { "OUT",      AK_FIXED,   OP_TRAP << 12 | TC_OUT },
+    { "PUTS",     AK_FIXED,   OP_TRAP << 12 | TC_PUTS },
+    { "IN",       AK_FIXED,   OP_TRAP << 12 | TC_IN },
+    { "PUTSP",    AK_FIXED,   OP_TRAP << 12 | TC_PUTSP },
+    { "HALT",     AK_FIXED,   OP_TRAP << 12 | TC_HALT },
+    { ".ORIG",    AK_ORIG,    0 },
+    { ".FILL",    AK_FILL,    0 },
+    { ".BLKW",    AK_BLKW,    0 },
+    { ".STRINGZ", AK_STRINGZ, 0 },
+    { ".END",     AK_END,     0 },
+};
+
+struct as_label {
+    char name[AS_LABEL_LEN];
+    uint16_t addr;
+};
+
+struct as_state {
+    struct lc3as_result* out;
+    struct as_label* labels;
+    int label_count;
+    int label_cap;
+    int pass;               // 1 collects labels and sizes, 2 emits words
+    int line;
+    uint32_t addr;          // address of the next word
+    int have_orig;
+    int done;               // .END seen
+};
+
+static int as_error(struct as_state* s, const char* fmt, ...) {
+    if(s->out->error[0]) return FALSE;
+
+    int n = snprintf(s->out->error, sizeof(s->out->error), "line %d: ", s->line);
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(s->out->error + n, sizeof(s->out->error) - n, fmt, ap);
+    va_end(ap);
+    return FALSE;
+}
+
+/* Split a line into tokens on blanks and commas, dropping the comment.
+A string literal stays one token, quotes included. */
+static int as_tokenize(char* p, char* tok[]) {
+    int n = 0;
+    while(*p) {
+        while(*p && (isspace((unsigned char)*p) || *p == ',')) ++p;
+        if(!*p || *p == ';') break;
+        if(n == AS_MAX_TOKENS) return -1;
+
+        tok[n++] = p;
+        if(*p == '"') {
+            for(++p; *p && *p != '"'; ++p)
+                if(*p == '\\' && p[1]) ++p;
+            if(*p) ++p;
+        } else {
+            while(*p && !isspace((unsigned char)*p) && *p != ',' && *p != ';') ++p;
+        }
+
+        if(*p == ';') {
+            *p = '\0';
+            break;
+        }
+        if(*p) *p++ = '\0';
+    }
+    return n;
+}
+
+static const struct as_mnemonic* as_find_mnemonic(const char* t, uint16_t* cond) {
+    for(size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); ++i)
+        if(strcasecmp(t, mnemonics[i].name) == 0) return &mnemonics[i];
+
+    /* BR, BRn, BRzp, ... with the flags in nzp order */
+    static const struct as_mnemonic br = { "BR", AK_BR, OP_BR << 12 };
+    if(strncasecmp(t, "BR", 2) != 0) return NULL;
+
+    const char* f = t + 2;
+    *cond = 0;
+    if(tolower((unsigned char)*f) == 'n') { *cond |= FL_N; ++f; }
+    if(tolower((unsigned char)*f) == 'z') { *cond |= FL_Z; ++f; }
+    if(tolower((unsigned char)*f) == 'p') { *cond |= FL_P; ++f; }
+    if(*f) return NULL;
+    if(*cond == 0) *cond = FL_N | FL_Z | FL_P;
+    return &br;
+}
+
+static int as_parse_number(const char* t, long* v) {
+    const char* p = t;
+    int base = 10;
+
+    if(*p == '#') ++p;
+    else if((*p == 'x' || *p == 'X') && p[1]) { base = 16; ++p; }
+    else if(*p == '0' && (p[1] == 'x' || p[1] == 'X') && p[2]) { base = 16; p += 2; }
+    else if(!isdigit((unsigned char)*p) && *p != '-') return FALSE;
+
+    int neg = *p == '-';
+    if(neg) ++p;
+    if(!*p) return FALSE;
+
+    char* end;
+    long n = strtol(p, &end, base);
+    if(*end || !isxdigit((unsigned char)*p)) return FALSE;
+
+    *v = neg ? -n : n;
+    return TRUE;
+}
+
+static int as_parse_register(const char* t, uint16_t* r) {
+    if((t[0] != 'R' && t[0] != 'r') || t[1] < '0' || t[1] > '7' || t[2]) return FALSE;
+    *r = t[1] - '0';
+    return TRUE;
+}
+
+static int as_valid_label(const char* t) {
+    uint16_t r;
+    if(!isalpha((unsigned char)*t) && *t != '_') return FALSE;
+    if(strlen(t) >= AS_LABEL_LEN || as_parse_register(t, &r)) return FALSE;
+    for(const char* p = t; *p; ++p)
+        if(!isalnum((unsigned char)*p) && *p != '_') return FALSE;
+    return TRUE;
+}
+
+static struct as_label* as_find_label(struct as_state* s, const char* name) {
+    for(int i = 0; i < s->label_count; ++i)
+        if(strcasecmp(s->labels[i].name, name) == 0) return &s->labels[i];
+    return NULL;
+}
+
+static int as_define_label(struct as_state* s, const char* name) {
+    if(!as_valid_label(name)) return as_error(s, "bad label '%s'", name);
+    if(as_find_label(s, name)) return as_error(s, "label '%s' defined twice", name);
+
+    if(s->label_count == s->label_cap) {
+        s->label_cap = s->label_cap ? s->label_cap * 2 : 64;
+        s->labels = realloc(s->labels, s->label_cap * sizeof(*s->labels));
+    }
+    struct as_label* l = &s->labels[s->label_count++];
+    strcpy(l->name, name);
+    l->addr = (uint16_t)s->addr;
+    return TRUE;
+}
+
+static int as_register(struct as_state* s, const char* t, uint16_t* r) {
+    if(!t) return as_error(s, "missing register");
+    if(!as_parse_register(t, r)) return as_error(s, "expected a register, got '%s'", t);
+    return TRUE;
+}
+
+/* Signed immediate of the given width */
+static int as_immediate(struct as_state* s, const char* t, int bits, uint16_t* field) {
+    long v;
+    if(!t) return as_error(s, "missing operand");
+    if(!as_parse_number(t, &v)) return as_error(s, "expected a number, got '%s'", t);
+    if(v < -(1l << (bits - 1)) || v >= 1l << (bits - 1)) return as_error(s, "%ld does not fit in %d bits", v, bits);
+    *field = (uint16_t)v & ((1u << bits) - 1);
+    return TRUE;
+}
+
+/* PC-relative operand: a label, or a literal offset */
+static int as_pc_offset(struct as_state* s, const char* t, int bits, uint16_t* field) {
+    if(!t) return as_error(s, "missing operand");
+
+    long v;
+    if(as_parse_number(t, &v)) return as_immediate(s, t, bits, field);
+    if(s->pass == 1) return TRUE;
+
+    const struct as_label* l = as_find_label(s, t);
+    if(!l) return as_error(s, "undefined label '%s'", t);
+
+    v = (long)l->addr - (long)(s->addr + 1);
+    if(v < -(1l << (bits - 1)) || v >= 1l << (bits - 1)) return as_error(s, "'%s' is out of range", t);
+    *field = (uint16_t)v & ((1u << bits) - 1);
+    return TRUE;
+}
+
+/* Decode a string literal, returns its length or -1 */
+static long as_string(const char* t, char* buf) {
+    size_t len = strlen(t);
+    if(len < 2 || t[0] != '"' || t[len - 1] != '"') return -1;
+
+    long n = 0;
+    for(const char* p = t + 1; p < t + len - 1; ++p) {
+        char c = *p;
+        if(c == '\\') {
+            switch(*++p) {
+                case 'n':  c = '\n'; break;
+                case 't':  c = '\t'; break;
+                case 'r':  c = '\r'; break;
+                case '0':  c = '\0'; break;
+                case 'e':  c = 0x1B; break;
+                default:   c = *p;   break;
+            }
+        }
+        buf[n++] = c;
+    }
+    return n;
+}
+
+static int as_emit(struct as_state* s, uint16_t word) {
+    if(s->addr > UINT16_MAX) return as_error(s, "program runs past xFFFF");
+    if(s->pass == 2) s->out->words[s->addr - s->out->origin] = word;
+    s->addr++;
+    return TRUE;
+}
+
+static int as_line(struct as_state* s, char* text) {
+    char* tok[AS_MAX_TOKENS];
+    int n = as_tokenize(text, tok);
+    if(n < 0) return as_error(s, "too many operands");
+    if(n == 0) return TRUE;
+
+    uint16_t cond = 0;
+    const struct as_mnemonic* m = as_find_mnemonic(tok[0], &cond);
+    int first = 0;
+
+    if(!m) {
+        /* a label, alone or in front of an instruction */
+        if(!s->have_orig) return as_error(s, ".ORIG expected before '%s'", tok[0]);
+        if(s->pass == 1 && !as_define_label(s, tok[0])) return FALSE;
+        if(n == 1) return TRUE;
+
+        first = 1;
+        m = as_find_mnemonic(tok[1], &cond);
+        if(!m) return as_error(s, "unknown instruction '%s'", tok[1]);
+    }
+
+    const char* a = n > first + 1 ? tok[first + 1] : NULL;
+    const char* b = n > first + 2 ? tok[first + 2] : NULL;
+    const char* c = n > first + 3 ? tok[first + 3] : NULL;
+    const int operands = n - first - 1;
+
+    if(m->kind == AK_ORIG) {
+        long v;
+        if(s->have_orig) return as_error(s, "only one .ORIG block is supported");
+        if(!a || !as_parse_number(a, &v) || v < 0 || v > UINT16_MAX) return as_error(s, ".ORIG needs an address");
+        s->have_orig = TRUE;
+        s->out->origin = (uint16_t)v;
+        s->addr = (uint32_t)v;
+        return TRUE;
+    }
+    if(!s->have_orig) return as_error(s, ".ORIG expected before '%s'", tok[first]);
+
+    static const int expected[] = {
+        [AK_ADD] = 3, [AK_NOT] = 2, [AK_BR] = 1, [AK_JMP] = 1, [AK_RET] = 0, [AK_JSR] = 1,
+        [AK_LOAD] = 2, [AK_BASE] = 3, [AK_TRAP] = 1, [AK_FIXED] = 0,
+        [AK_FILL] = 1, [AK_BLKW] = 1, [AK_STRINGZ] = 1, [AK_END] = 0
+    };
+    if(operands != expected[m->kind])
+        return as_error(s, "%s takes %d operand%s", m->name, expected[m->kind], expected[m->kind] == 1 ? "" : "s");
+
+    uint16_t r1 = 0, r2 = 0, r3 = 0, field = 0;
+    long v;
+
+    switch(m->kind) {
+        case AK_ADD:
+            if(!as_register(s, a, &r1) || !as_register(s, b, &r2)) return FALSE;
+            if(as_parse_register(c, &r3)) return as_emit(s, m->bits | r1 << 9 | r2 << 6 | r3);
+            if(!as_immediate(s, c, 5, &field)) return FALSE;
+            return as_emit(s, m->bits | r1 << 9 | r2 << 6 | 1 << 5 | field);
+        case AK_NOT:
+            if(!as_register(s, a, &r1) || !as_register(s, b, &r2)) return FALSE;
+            return as_emit(s, m->bits | r1 << 9 | r2 << 6);
+        case AK_BR:
+            if(!as_pc_offset(s, a, 9, &field)) return FALSE;
+            return as_emit(s, m->bits | cond << 9 | field);
+        case AK_JMP:
+            if(!as_register(s, a, &r1)) return FALSE;
+            return as_emit(s, m->bits | r1 << 6);
+        case AK_JSR:
+            if(!as_pc_offset(s, a, 11, &field)) return FALSE;
+            return as_emit(s, m->bits | field);
+        case AK_LOAD:
+            if(!as_register(s, a, &r1) || !as_pc_offset(s, b, 9, &field)) return FALSE;
+            return as_emit(s, m->bits | r1 << 9 | field);
+        case AK_BASE:
+            if(!as_register(s, a, &r1) || !as_register(s, b, &r2) || !as_immediate(s, c, 6, &field)) return FALSE;
+            return as_emit(s, m->bits | r1 << 9 | r2 << 6 | field);
+        case AK_TRAP:
+            if(!as_parse_number(a, &v) || v < 0 || v > 0xFF) return as_error(s, "bad trap vector '%s'", a);
+            return as_emit(s, m->bits | (uint16_t)v);
+        case AK_RET:
+        case AK_FIXED:
+            return as_emit(s, m->bits);
+        case AK_FILL:
+            if(as_parse_number(a, &v)) {
+                if(v < INT16_MIN || v > UINT16_MAX) return as_error(s, "%ld does not fit in 16 bits", v);
+                return as_emit(s, (uint16_t)v);
+            }
+            if(s->pass == 1) return as_emit(s, 0);
+            {
+                const struct as_label* l = as_find_label(s, a);
+                if(!l) return as_error(s, "undefined label '%s'", a);
+                return as_emit(s, l->addr);
+            }
+        case AK_BLKW:
+            if(!as_parse_number(a, &v) || v < 1 || v > UINT16_MAX) return as_error(s, "bad .BLKW count '%s'", a);
+            while(v-- > 0)
+                if(!as_emit(s, 0)) return FALSE;
+            return TRUE;
+        case AK_STRINGZ: {
+            char buf[AS_MAX_LINE];
+            long len = as_string(a, buf);
+            if(len < 0) return as_error(s, ".STRINGZ needs a quoted string");
+            for(long i = 0; i < len; ++i)
+                if(!as_emit(s, (uint8_t)buf[i])) return FALSE;
+            return as_emit(s, 0);
+        }
+        case AK_END:
+            s->done = TRUE;
+            return TRUE;
+        case AK_ORIG:
+            break;
+    }
+    return TRUE;
+}
+
+static int as_pass(struct as_state* s, const char* src, size_t len) {
+    const char* end = src + len;
+    char text[AS_MAX_LINE];
+
+    s->line      = 0;
+    s->addr      = s->out->origin;
+    s->have_orig = FALSE;
+    s->done      = FALSE;
+
+    for(const char* p = src; p < end && !s->done; ) {
+        const char* nl = memchr(p, '\n', end - p);
+        const size_t n = (nl ? nl : end) - p;
+        s->line++;
+
+        if(n >= sizeof(text)) return as_error(s, "line too long");
+        memcpy(text, p, n);
+        text[n] = '\0';
+        if(n && text[n - 1] == '\r') text[n - 1] = '\0';
+
+        if(!as_line(s, text)) return FALSE;
+        p += n + 1;
+    }
+
+    if(!s->have_orig) return as_error(s, "no .ORIG in source");
+    return TRUE;
+}
+
+int lc3as_assemble(const char* src, size_t len, struct lc3as_result* out) {
+    struct as_state s = { .out = out };
+    out->origin   = 0;
+    out->length   = 0;
+    out->error[0] = '\0';
+
+    int ok = FALSE;
+    s.pass = 1;
+    if(as_pass(&s, src, len)) {
+        out->length = s.addr - out->origin;
+        s.pass = 2;
+        ok = as_pass(&s, src, len);
+    }
+
+    free(s.labels);
+    return ok;
+}
+
+int lc3as_write_image(const struct lc3as_result* r, FILE* f) {
+    uint8_t be[2] = { r->origin >> 8, r->origin & 0xFF };
+    if(fwrite(be, 1, 2, f) != 2) return FALSE;
+
+    for(uint32_t i = 0; i < r->length; ++i) {
+        be[0] = r->words[i] >> 8;
+        be[1] = r->words[i] & 0xFF;
+        if(fwrite(be, 1, 2, f) != 2) return FALSE;
+    }
+    return TRUE;
+}
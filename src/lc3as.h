@@ -0,0 +1,29 @@
+/* Two pass LC-3 assembler
+
+Accepts the usual lc3as dialect: one .ORIG block, labels, all opcodes
+including the trap aliases (GETC, OUT, PUTS, IN, PUTSP, HALT), and the
+.FILL, .BLKW, .STRINGZ and .END directives. Numbers are #decimal,
+xHEX or plain decimal. Opcodes and labels are case-insensitive. */
+
+#ifndef LC3AS_H
+#define LC3AS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LC3AS_VERSION 1     // bump when the output for the same source can change
+
+struct lc3as_result {
+    uint16_t origin;
+    uint32_t length;                    // words after the origin
+    uint16_t words[UINT16_MAX + 1];
+    char error[256];                    // first error, with its line number
+};
+
+/* Assemble len bytes of source, 1 on success */
+int lc3as_assemble(const char* src, size_t len, struct lc3as_result* out);
+
+/* Write out as an image file: big-endian origin, then the words */
+int lc3as_write_image(const struct lc3as_result* r, FILE* f);
+
+#endif
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE         // sched_setaffinity and the CPU_* macros
+#include "preprocessor.h"
+#include "numa.h"
+
+#ifdef __UNIX
+#include <sched.h>
+#endif
+
+#ifndef NUMA_SYSFS
+#define NUMA_SYSFS "/sys/devices/system/node"
+#endif
+
+#ifdef __UNIX
+/* Parse a kernel CPU list ("0-3,8,10-11") into a mask */
+static int parse_list(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+    for(const char* p = list; *p && *p != '\n'; ) {
+        char* end;
+        const long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if(end == p || lo < 0) return FALSE;
+        if(*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if(end == p || hi < lo) return FALSE;
+        }
+        for(long c = lo; c <= hi && c < CPU_SETSIZE; ++c) CPU_SET(c, set);
+        p = *end == ',' ? end + 1 : end;
+        if(end == p && *p && *p != '\n') return FALSE;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+static int read_line(const char* path, char* buf, size_t size) {
+    FILE* f = fopen(path, "r");
+    if(!f) return FALSE;
+    const int ok = fgets(buf, (int)size, f) != NULL;
+    fclose(f);
+    return ok;
+}
+#endif
+
+int numa_topology(struct numa_topology* t) {
+    memset(t, 0, sizeof(*t));
+#ifdef __UNIX
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return FALSE;
+
+    char path[256], line[4096];
+    int number[NUMA_MAX_NODES];         // kernel node number of each node we keep
+    for(int node = 0; node < NUMA_MAX_NODES; ++node) {
+        snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/cpulist", node);
+        cpu_set_t cpus;
+        if(!read_line(path, line, sizeof(line)) || !parse_list(line, &cpus)) continue;    // absent, or memory only
+
+        t->first[t->nodes] = t->cpus;
+        for(int c = 0; c < CPU_SETSIZE && t->cpus < NUMA_MAX_CPUS; ++c)
+            if(CPU_ISSET(c, &cpus) && CPU_ISSET(c, &allowed)) t->cpu[t->cpus++] = c;
+        if(t->cpus == t->first[t->nodes]) continue;         // none of it is ours
+
+        /* the row is indexed by kernel node numbers until the fix-up below */
+        snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/distance", node);
+        int* row = t->distance[t->nodes];
+        for(int n = 0; n < NUMA_MAX_NODES; ++n) row[n] = n == node ? 10 : 20;
+        if(read_line(path, line, sizeof(line))) {
+            char* p = line;
+            for(int n = 0; n < NUMA_MAX_NODES; ++n) {
+                char* end;
+                const long d = strtol(p, &end, 10);
+                if(end == p) break;
+                row[n] = (int)d;
+                p = end;
+            }
+        }
+        number[t->nodes++] = node;
+    }
+
+    if(t->nodes == 0) {
+        for(int c = 0; c < CPU_SETSIZE && t->cpus < NUMA_MAX_CPUS; ++c)
+            if(CPU_ISSET(c, &allowed)) t->cpu[t->cpus++] = c;
+        t->nodes = 1;
+        t->distance[0][0] = 10;
+    } else {
+        int rows[NUMA_MAX_NODES][NUMA_MAX_NODES];
+        memcpy(rows, t->distance, sizeof(rows));
+        for(int i = 0; i < t->nodes; ++i)
+            for(int j = 0; j < t->nodes; ++j) t->distance[i][j] = rows[i][number[j]];
+    }
+    t->first[t->nodes] = t->cpus;
+#else
+    t->nodes = 1;
+    t->cpus = 1;
+    t->first[1] = 1;
+    t->distance[0][0] = 10;
+#endif
+    return TRUE;
+}
+
+int numa_worker_node(const struct numa_topology* t, int w) {
+    return w % t->nodes;
+}
+
+int numa_worker_cpu(const struct numa_topology* t, int w) {
+    const int node = numa_worker_node(t, w);
+    const int size = t->first[node + 1] - t->first[node];
+    return t->cpu[t->first[node] + (w / t->nodes) % size];
+}
+
+int numa_victims(const struct numa_topology* t, int node, int* order) {
+    int count = 0;
+    for(int n = 0; n < t->nodes; ++n) {
+        if(n == node) continue;
+        int i = count++;
+        while(i > 0 && t->distance[node][order[i - 1]] > t->distance[node][n]) {
+            order[i] = order[i - 1];
+            --i;
+        }
+        order[i] = n;
+    }
+    return count;
+}
+
+int numa_pin(int cpu) {
+#ifdef __UNIX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return FALSE;
+#endif
+}
+
+int numa_pin_list(const char* list) {
+#ifdef __UNIX
+    cpu_set_t set;
+    return parse_list(list, &set) && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return FALSE;
+#endif
+}
@@ -0,0 +1,38 @@
+/* NUMA placement without libnuma
+
+The topology comes from /sys/devices/system/node, restricted to the CPUs
+this process may run on; a machine without that directory is one node.
+Memory keeps the kernel's default first-touch policy: a process pinned
+before it touches its pages gets them from its own node, so pinning
+early is all the placement a VM or a worker needs. */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#define NUMA_MAX_NODES  64
+#define NUMA_MAX_CPUS   1024
+
+struct numa_topology {
+    int nodes;
+    int cpus;
+    int cpu[NUMA_MAX_CPUS];                     // usable CPUs, grouped by node
+    int first[NUMA_MAX_NODES + 1];              // node n has cpu[first[n]] .. cpu[first[n + 1] - 1]
+    int distance[NUMA_MAX_NODES][NUMA_MAX_NODES];   // SLIT distances, 10 = local
+};
+
+/* Fill t; FALSE only if not even the affinity mask can be read */
+int numa_topology(struct numa_topology* t);
+
+/* Node and CPU for worker w: workers go round-robin over the nodes, so
+any number of them is spread over every socket */
+int numa_worker_node(const struct numa_topology* t, int w);
+int numa_worker_cpu(const struct numa_topology* t, int w);
+
+/* The other nodes, nearest first, for stealing work; returns how many */
+int numa_victims(const struct numa_topology* t, int node, int* order);
+
+/* Restrict the calling process to one CPU, or to a list like "0-3,8" */
+int numa_pin(int cpu);
+int numa_pin_list(const char* list);
+
+#endif
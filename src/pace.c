@@ -0,0 +1,92 @@
+#include "preprocessor.h"
+#include "stats.h"
+#include "vm.h"
+#include "pace.h"
+
+#ifdef __UNIX
+#include <errno.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#endif
+
+static uint64_t pace_hz;
+static uint64_t pace_insns;             // per slice
+static int pace_fd = -1;
+
+static uint64_t pace_base_ns;           // when pace_base_retired was due
+static uint64_t pace_base_retired;
+static uint64_t pace_seen_wait;         // input wait time already taken out
+
+void pace_init(void) {
+#ifdef __UNIX
+    const char* hz = getenv("TYVM_HZ");
+    if(!hz || strtoull(hz, NULL, 10) == 0) return;
+
+    pace_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if(pace_fd < 0) {
+        fprintf(stderr, "tyvm: no timerfd, TYVM_HZ ignored\n");
+        return;
+    }
+    prctl(PR_SET_TIMERSLACK, 1UL);      // the default 50 us slack would be most of the jitter
+
+    pace_hz = strtoull(hz, NULL, 10);
+    pace_insns = pace_hz * PACE_SLICE_NS / 1000000000u;
+    if(pace_insns == 0) pace_insns = 1;
+    stats->pace_hz = pace_hz;
+#endif
+}
+
+uint64_t pace_slice(void) {
+    if(pace_hz && !pace_base_ns) {      // the guest clock starts with the first slice
+        pace_base_ns = stats_now_ns();
+        pace_base_retired = vm_retired;
+    }
+    return pace_insns;
+}
+
+/* When the n-th instruction after the base is due, without overflowing n * 1e9 */
+static uint64_t due(uint64_t n) {
+    return pace_base_ns + n / pace_hz * 1000000000u + n % pace_hz * 1000000000u / pace_hz;
+}
+
+void pace_wait(void) {
+#ifdef __UNIX
+    if(!pace_hz) return;
+
+    const uint64_t now = stats_now_ns();
+
+    /* guest time stands still while the guest waits for input */
+    pace_base_ns += stats->input_wait_ns - pace_seen_wait;
+    pace_seen_wait = stats->input_wait_ns;
+
+    const uint64_t deadline = due(vm_retired - pace_base_retired);
+    if(now >= deadline) {
+        stats->pace_overruns++;
+        if(now - deadline > PACE_MAX_LAG_NS) {
+            pace_base_ns = now;
+            pace_base_retired = vm_retired;
+        }
+        return;
+    }
+
+    struct itimerspec when = {{0, 0}, {deadline / 1000000000u, deadline % 1000000000u}};
+    timerfd_settime(pace_fd, TFD_TIMER_ABSTIME, &when, NULL);
+
+    uint64_t expirations;
+    while(read(pace_fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+    stats_pace_late(stats_now_ns() - deadline);
+#endif
+}
+
+void pace_report(void) {
+    if(!pace_hz) return;
+
+    fprintf(stderr, "pace: %lu Hz, %lu sleeps, %lu overruns, mean late %.1f us\n", (unsigned long)pace_hz,
+            (unsigned long)stats->pace_sleeps, (unsigned long)stats->pace_overruns,
+            stats->pace_sleeps ? stats->pace_late_ns / 1e3 / stats->pace_sleeps : 0.0);
+    for(int b = 0; b < STATS_HIST_BUCKETS; ++b) {
+        if(!stats->pace_late_hist[b]) continue;
+        if(b < STATS_HIST_BUCKETS - 1) fprintf(stderr, "  late < %8lu us  %lu\n", 1ul << b, (unsigned long)stats->pace_late_hist[b]);
+        else fprintf(stderr, "  late >= %7lu us  %lu\n", 1ul << (b - 1), (unsigned long)stats->pace_late_hist[b]);
+    }
+}
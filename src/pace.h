@@ -0,0 +1,35 @@
+/* Paced execution at a fixed guest clock
+
+With TYVM_HZ set (for example 2000000 for 2 MHz), the guest runs in
+slices of 1 ms worth of instructions and sleeps between them on a
+timerfd until the absolute time at which the instructions retired so
+far were due. Deadlines are computed from the start, never from the
+last wake-up, so lateness does not add up into drift. Time the guest
+spends waiting for input does not count. A host that falls more than
+PACE_MAX_LAG_NS behind drops the lost time instead of bursting to
+catch up.
+
+Wake-up lateness goes into a histogram in the stats page and is
+printed on exit. */
+
+#ifndef PACE_H
+#define PACE_H
+
+#include <stdint.h>
+
+#define PACE_SLICE_NS   1000000u        // guest time per slice
+#define PACE_MAX_LAG_NS 10000000u
+
+/* Read TYVM_HZ */
+void pace_init(void);
+
+/* Instructions per slice, 0 when not paced */
+uint64_t pace_slice(void);
+
+/* Sleep until the retired instructions are due */
+void pace_wait(void);
+
+/* Print the lateness histogram to stderr, if paced */
+void pace_report(void);
+
+#endif
@@ -1,4 +1,9 @@
-/* preprocessor directves needed to run tyvm.c */
+/* preprocessor directves needed by every tyvm source file */
+
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+
+#define _DEFAULT_SOURCE     // expose POSIX/BSD declarations under --std=c11
 
 #define __UNIX              // used to modify code whether compiling on a Unix-based OS or a Windows machine
 
@@ -26,8 +31,10 @@
 #endif
 
 #ifndef __UNIX
-    HANDLE hStdin = INVALID_HANDLE_VALUE;
+    extern HANDLE hStdin;
 #endif
 
 #define TRUE 1
-#define FALSE 0
\ No newline at end of file
+#define FALSE 0
+
+#endif
@@ -0,0 +1,55 @@
+/* Binary result stream (.tyr)
+
+What tyvm-run writes for a batch, one fixed-size record per job, so a
+batch of hundreds of thousands of jobs costs no text formatting:
+
+    struct tyr_header
+    struct tyr_record[records]  in the order the jobs finished
+    uint32_t index[jobs]        record number of each job, TYR_NONE if it has none
+
+The console output of every job goes to a second file, the blob (the
+stream's name with .blob appended), at record.output_offset. Records are
+appended as the batch runs; the header counts and the index offset are
+filled in when it ends, so a reader that finds index_offset 0 is looking
+at an unfinished stream and can still read the whole records it has.
+
+Integers are in host byte order, as in archive.h; tyvm-results converts
+a stream to JSON or CSV. */
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdint.h>
+
+#define TYR_MAGIC   0x52565954      // "TYVR"
+#define TYR_VERSION 1
+#define TYR_NONE    UINT32_MAX
+
+/* Why a job ended: the first three are enum vm_exit */
+enum tyr_exit {
+    TYR_LIMIT = 0,          // instruction limit reached
+    TYR_HALT,
+    TYR_ILLEGAL,
+    TYR_ERROR               // the archive holds an assembler error, or an unusable image
+};
+
+struct tyr_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;       // sizeof(struct tyr_record)
+    uint32_t jobs;              // entries in the archive
+    uint64_t records;
+    uint64_t index_offset;      // 0 until the batch is complete
+};
+
+struct tyr_record {
+    uint32_t job;               // entry number in the archive
+    uint32_t exit;              // enum tyr_exit
+    uint64_t retired;
+    uint64_t output_hash;       // FNV-1a 64, as in the TYVM_SUMMARY line
+    uint64_t output_offset;     // in the blob
+    uint32_t output_length;
+    uint32_t reserved;
+};
+
+#endif
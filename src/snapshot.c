@@ -0,0 +1,99 @@
+#include "preprocessor.h"
+#include "registers.h"
+#include "stats.h"
+#include "snapshot.h"
+
+volatile sig_atomic_t snapshot_pending;
+uint32_t block_hits[UINT16_MAX + 1];
+
+#define SNAPSHOT_MAX_TOP 256
+
+static unsigned snapshot_count;
+
+static const char* snapshot_opcodes[16] = {
+    "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+};
+
+void snapshot_init(void) {
+#ifdef __UNIX
+    signal(SIGUSR1, handle_snapshot);
+#endif
+}
+
+void handle_snapshot(int signal) {
+    snapshot_pending = TRUE;
+}
+
+/* Append one dump to path; s is a copy of the counters taken with the registers */
+static void write_snapshot(const char* path, const struct vm_stats* s) {
+    const char* top_env = getenv("TYVM_DUMP_TOP");
+    int top = top_env ? atoi(top_env) : 10;
+
+    FILE* out = fopen(path, "a");
+    if(!out) return;
+
+    fprintf(out, "snapshot %u pid %d uptime %.3fs state %lu\n", snapshot_count, (int)s->pid,
+            (stats_now_ns() - s->start_ns) / 1e9, (unsigned long)s->state);
+    fprintf(out, "instructions %lu\n", (unsigned long)stats_instructions(s));
+    fprintf(out, "PC x%04X  instr x%04X  COND %c\n", reg[RG_PC], memory[reg[RG_PC]],
+            reg[RG_COND] == FL_N ? 'N' : reg[RG_COND] == FL_Z ? 'Z' : 'P');
+    for(int r = RG_R0; r <= RG_R7; ++r)
+        fprintf(out, "R%d x%04X%s", r, reg[r], r == RG_R3 || r == RG_R7 ? "\n" : "  ");
+
+    fprintf(out, "opcodes");
+    for(int op = 0; op < 16; ++op)
+        if(s->opcodes[op]) fprintf(out, " %s=%lu", snapshot_opcodes[op], (unsigned long)s->opcodes[op]);
+    fprintf(out, "\ntraps GETC=%lu OUT=%lu PUTS=%lu IN=%lu PUTSP=%lu HALT=%lu\n",
+            (unsigned long)s->traps[0], (unsigned long)s->traps[1], (unsigned long)s->traps[2],
+            (unsigned long)s->traps[3], (unsigned long)s->traps[4], (unsigned long)s->traps[5]);
+
+    /* insertion into a small sorted table, one pass over the counters */
+    uint16_t hot[SNAPSHOT_MAX_TOP];
+    int hot_count = 0;
+    if(top > SNAPSHOT_MAX_TOP) top = SNAPSHOT_MAX_TOP;
+
+    for(int pc = 0; top > 0 && pc <= UINT16_MAX; ++pc) {       // TYVM_DUMP_TOP=0 leaves the table empty
+        if(block_hits[pc] == 0) continue;
+        if(hot_count == top && block_hits[pc] <= block_hits[hot[hot_count - 1]]) continue;
+
+        int i = hot_count < top ? hot_count++ : hot_count - 1;
+        while(i > 0 && block_hits[hot[i - 1]] < block_hits[pc]) {
+            hot[i] = hot[i - 1];
+            --i;
+        }
+        hot[i] = pc;
+    }
+
+    fprintf(out, "hot blocks\n");
+    for(int i = 0; i < hot_count; ++i) fprintf(out, "  x%04X %u\n", hot[i], block_hits[hot[i]]);
+    fprintf(out, "\n");
+    fclose(out);
+}
+
+void take_snapshot(void) {
+    snapshot_pending = FALSE;
+    snapshot_count++;
+
+    /* named after the VM, not after the child that writes it */
+    char path[4096];
+    const char* dump = getenv("TYVM_DUMP");
+    if(dump && *dump) snprintf(path, sizeof(path), "%s", dump);
+    else snprintf(path, sizeof(path), "tyvm-%d.dump", (int)getpid());
+
+    /* with TYVM_STATS the counters are a shared page the parent keeps
+    updating after the fork: the child gets a copy from this instant */
+    const struct vm_stats counters = *stats;
+
+#ifdef __UNIX
+    fflush(stdout);             // do not duplicate buffered guest output in the child
+    signal(SIGCHLD, SIG_IGN);   // dump writers are never waited for
+    pid_t pid = fork();
+    if(pid == 0) {
+        write_snapshot(path, &counters);
+        _exit(0);
+    }
+    if(pid > 0) return;
+#endif
+    write_snapshot(path, &counters);    // no fork: write it inline
+}
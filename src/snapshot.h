@@ -0,0 +1,35 @@
+/* Live introspection of a running VM
+
+SIGUSR1 only raises a flag. The interpreter checks it at the next block
+boundary (after BR, JMP, JSR or TRAP), where the guest state is
+consistent, and forks: the child writes the dump while the parent keeps
+running the guest on its own copy-on-write pages. A VM waiting for input
+in GETC/IN is just as consistent: the signal ends the wait (see idle.h)
+and the dump is taken there. */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <signal.h>
+#include <stdint.h>
+
+/* Opcodes after which a new basic block starts */
+#define BLOCK_END_OPS ((1 << OP_BR) | (1 << OP_JMP) | (1 << OP_JSR) | (1 << OP_TRAP))
+
+/* Set by the SIGUSR1 handler, cleared once the snapshot is taken */
+extern volatile sig_atomic_t snapshot_pending;
+
+/* Block entry counters, indexed by the block start address */
+extern uint32_t block_hits[UINT16_MAX + 1];
+
+/* Install the SIGUSR1 handler */
+void snapshot_init(void);
+
+/* SIGUSR1 handler */
+void handle_snapshot(int signal);
+
+/* Write PC, registers, counters and the hottest blocks to the dump file
+(TYVM_DUMP, default tyvm-<pid>.dump) */
+void take_snapshot(void);
+
+#endif
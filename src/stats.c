@@ -0,0 +1,98 @@
+#include "preprocessor.h"
+#include "stats.h"
+
+#include <time.h>
+
+static struct vm_stats local_stats;
+struct vm_stats* stats = &local_stats;
+
+static char stats_shm_name[256];
+static int stats_bench_fd = -1;
+
+void stats_init(void) {
+#ifdef __UNIX
+    const char* name = getenv("TYVM_STATS");
+
+    if(name && *name) {
+        /* shm names must start with a single slash */
+        snprintf(stats_shm_name, sizeof(stats_shm_name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+        /* created read-only for everyone: only this process, which holds
+        the writable mapping, can change the counters */
+        shm_unlink(stats_shm_name);
+        int fd = shm_open(stats_shm_name, O_CREAT | O_EXCL | O_RDWR, 0444);
+        if(fd < 0 || ftruncate(fd, sizeof(struct vm_stats)) != 0) {
+            fprintf(stderr, "tyvm: cannot create stats page %s\n", stats_shm_name);
+            if(fd >= 0) close(fd);
+            stats_shm_name[0] = '\0';
+        } else {
+            void* page = mmap(NULL, sizeof(struct vm_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if(page == MAP_FAILED) {
+                shm_unlink(stats_shm_name);
+                stats_shm_name[0] = '\0';
+            } else stats = page;
+        }
+    }
+
+    const char* bench = getenv("TYVM_BENCH_FD");
+    if(bench && *bench) stats_bench_fd = atoi(bench);
+#endif
+
+    stats->pid      = getpid();
+    stats->start_ns = stats_now_ns();
+    stats->state    = VS_LOADING;
+    stats->version  = STATS_VERSION;
+    stats->magic    = STATS_MAGIC;     // written last: readers treat the page as valid from here on
+}
+
+void stats_close(void) {
+    if(stats_shm_name[0]) shm_unlink(stats_shm_name);
+}
+
+int stats_shared(void) {
+    return stats_shm_name[0] != '\0';
+}
+
+void stats_mark(void) {
+#ifdef __UNIX
+    if(stats_bench_fd < 0) return;
+    const uint64_t now = stats_now_ns();
+    write(stats_bench_fd, &now, sizeof(now));
+#endif
+}
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* log2 microsecond bucket of a duration */
+static int stats_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while(us && bucket < STATS_HIST_BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void stats_input_wait(uint64_t ns) {
+    stats->input_waits++;
+    stats->input_wait_ns += ns;
+    stats->input_wait_hist[stats_bucket(ns)]++;
+}
+
+void stats_pace_late(uint64_t ns) {
+    stats->pace_sleeps++;
+    stats->pace_late_ns += ns;
+    stats->pace_late_hist[stats_bucket(ns)]++;
+}
+
+uint64_t stats_instructions(const volatile struct vm_stats* s) {
+    uint64_t n = 0;
+    for(int i = 0; i < 16; ++i) n += s->opcodes[i];
+    return n;
+}
@@ -0,0 +1,90 @@
+/* Live counters of a running tyvm
+
+The VM updates a single struct vm_stats from its only thread with plain
+stores, no locks. When TYVM_STATS names a shared memory object the struct
+lives in that page, so monitors (see tyvm_stat.c) can map it read-only
+and sample it while the guest runs. The layout is the ABI between the two:
+append new fields at the end and bump STATS_VERSION. */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#define STATS_MAGIC         0x53565954      // "TYVS"
+#define STATS_VERSION       3
+#define STATS_HIST_BUCKETS  24              // log2 microsecond buckets, last one is +Inf
+
+/* What the VM is doing right now */
+enum vm_run_state {
+    VS_LOADING = 0,
+    VS_RUNNING,
+    VS_WAITING,         // blocked in TC_GETC/TC_IN waiting for input
+    VS_HALTED
+};
+
+/* How much of a waiting VM is still resident (see idle.h) */
+enum idle_tier {
+    IT_AWAKE = 0,
+    IT_PACKED,          // pages compressed in memory, originals released
+    IT_HIBERNATED       // compressed pages in a file, nothing left in memory
+};
+
+struct vm_stats {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t pid;
+    uint64_t start_ns;                      // CLOCK_MONOTONIC when the VM started
+    uint64_t state;                         // enum vm_run_state
+
+    uint64_t opcodes[16];                   // retired instructions by opcode
+    uint64_t traps[6];                      // TC_GETC .. TC_HALT
+    uint64_t mem_reads;                     // including instruction fetches
+    uint64_t mem_writes;
+    uint64_t kbd_polls;                     // reads of MR_KSR
+    uint64_t kbd_hits;                      // ... that found a key ready
+
+    uint64_t input_waits;                   // blocking reads in TC_GETC/TC_IN
+    uint64_t input_wait_ns;                 // total time spent in them
+    uint64_t input_wait_hist[STATS_HIST_BUCKETS];
+
+    uint64_t idle_tier;                     // enum idle_tier
+    uint64_t idle_packs;                    // times the pages were compressed
+    uint64_t idle_hibernations;             // ... and then written out
+    uint64_t idle_packed_bytes;             // size of the last compressed state
+
+    uint64_t pace_hz;                       // target guest clock (see pace.h), 0 = flat out
+    uint64_t pace_sleeps;                   // slices that ended in a sleep
+    uint64_t pace_overruns;                 // slices that ended past their deadline, no sleep
+    uint64_t pace_late_ns;                  // total wake-up lateness of the sleeps
+    uint64_t pace_late_hist[STATS_HIST_BUCKETS];
+};
+
+extern struct vm_stats* stats;
+
+/* Point stats at a shared memory page if TYVM_STATS is set, else at a private copy */
+void stats_init(void);
+
+/* Remove the shared memory object on shutdown */
+void stats_close(void);
+
+/* Monotonic clock in nanoseconds */
+uint64_t stats_now_ns(void);
+
+/* Account one blocking input read that took ns nanoseconds */
+void stats_input_wait(uint64_t ns);
+
+/* Account one paced sleep that woke ns nanoseconds after its deadline */
+void stats_pace_late(uint64_t ns);
+
+/* Whether the counters live in a shared page that stats_close must remove */
+int stats_shared(void);
+
+/* For tyvm-bench: with TYVM_BENCH_FD set, write the monotonic clock to that
+fd as a raw uint64_t. The VM marks its first instruction and its end. */
+void stats_mark(void);
+
+/* Total retired instructions */
+uint64_t stats_instructions(const volatile struct vm_stats* s);
+
+#endif
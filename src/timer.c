@@ -0,0 +1,177 @@
+#include "preprocessor.h"
+#include "stats.h"
+#include "timer.h"
+
+#ifdef __UNIX
+#include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#endif
+
+#define TIMER_TICK_NS   1000000u
+#define TIMER_BITS      6
+#define TIMER_SLOTS     (1 << TIMER_BITS)
+#define TIMER_LEVELS    4
+#define TIMER_SPAN      ((uint64_t)1 << (TIMER_BITS * TIMER_LEVELS))     // ticks the wheel reaches
+#define TIMER_NEVER     UINT64_MAX
+
+int timer_stop;
+
+/* Slot heads of circular lists; a level L slot holds the timers whose
+deadline is 64^L to 64^(L+1) ticks past wheel_now when they were placed */
+static struct vm_timer wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t occupied[TIMER_LEVELS];
+static unsigned wheel_count;
+
+static uint64_t wheel_base;             // CLOCK_MONOTONIC of tick 0
+static uint64_t wheel_now;              // last tick processed
+static uint64_t wheel_armed;            // tick the timerfd is set for, 0 = unknown
+static int wheel_fd = -1;
+
+static void wheel_init(void) {
+    if(wheel_base) return;
+    wheel_base = stats_now_ns();
+    for(int l = 0; l < TIMER_LEVELS; ++l)
+        for(int s = 0; s < TIMER_SLOTS; ++s) wheel[l][s].next = wheel[l][s].prev = &wheel[l][s];
+
+#ifdef __UNIX
+    wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(wheel_fd < 0) fprintf(stderr, "tyvm: no timerfd, blocked reads will not time out\n");
+#endif
+}
+
+static uint64_t now_tick(void) {
+    return (stats_now_ns() - wheel_base) / TIMER_TICK_NS;
+}
+
+static void wheel_insert(struct vm_timer* t) {
+    uint64_t delta = t->expires - wheel_now;     // 0 only when cascaded into the slot being processed
+    if(delta >= TIMER_SPAN) delta = TIMER_SPAN - 1;     // comes round again, placed anew then
+
+    int level = 0;
+    while(level < TIMER_LEVELS - 1 && delta >> (TIMER_BITS * (level + 1))) ++level;
+    const int slot = ((wheel_now + delta) >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1);
+
+    struct vm_timer* head = &wheel[level][slot];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    t->level = (uint8_t)level;
+    t->slot  = (uint8_t)slot;
+    occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void wheel_remove(struct vm_timer* t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    const struct vm_timer* head = &wheel[t->level][t->slot];
+    if(head->next == head) occupied[t->level] &= ~((uint64_t)1 << t->slot);
+    t->next = t->prev = NULL;
+}
+
+/* First tick after wheel_now at which a slot fires or cascades */
+static uint64_t wheel_next(void) {
+    uint64_t next = TIMER_NEVER;
+    for(int l = 0; l < TIMER_LEVELS; ++l) {
+        if(!occupied[l]) continue;
+        const int shift = TIMER_BITS * l;
+        const uint64_t first = (wheel_now >> shift) + 1;        // the next time this level turns
+        const int s = first & (TIMER_SLOTS - 1);
+        const uint64_t rotated = occupied[l] >> s | (s ? occupied[l] << (TIMER_SLOTS - s) : 0);
+        const uint64_t tick = (first + __builtin_ctzll(rotated)) << shift;
+        if(tick < next) next = tick;
+    }
+    return next;
+}
+
+/* Point the timerfd at the next slot, or disarm it */
+static void wheel_program(void) {
+    const uint64_t next = wheel_count ? wheel_next() : TIMER_NEVER;
+    if(next == wheel_armed) return;
+    wheel_armed = next;
+
+#ifdef __UNIX
+    if(wheel_fd < 0) return;
+    struct itimerspec when = {{0, 0}, {0, 0}};
+    if(next != TIMER_NEVER) {
+        const uint64_t ns = wheel_base + next * TIMER_TICK_NS;
+        when.it_value.tv_sec  = ns / 1000000000u;
+        when.it_value.tv_nsec = ns % 1000000000u;
+    }
+    timerfd_settime(wheel_fd, TFD_TIMER_ABSTIME, &when, NULL);
+#endif
+}
+
+/* Move wheel_now to tick: cascade the higher levels that turn, then fire the slot */
+static void wheel_process(uint64_t tick) {
+    wheel_now = tick;
+
+    for(int l = 1; l < TIMER_LEVELS && !(tick & ((((uint64_t)1) << (TIMER_BITS * l)) - 1)); ++l) {
+        struct vm_timer* head = &wheel[l][(tick >> (TIMER_BITS * l)) & (TIMER_SLOTS - 1)];
+        while(head->next != head) {
+            struct vm_timer* t = head->next;
+            wheel_remove(t);
+            wheel_insert(t);
+        }
+    }
+
+    struct vm_timer* head = &wheel[0][tick & (TIMER_SLOTS - 1)];
+    while(head->next != head) {
+        struct vm_timer* t = head->next;
+        wheel_remove(t);
+        wheel_count--;
+        t->fire(t);         // may arm it again, into a later slot
+    }
+}
+
+void timer_arm(struct vm_timer* t, uint64_t ns) {
+    wheel_init();
+    if(t->next) timer_cancel(t);
+    if(!wheel_count) wheel_now = now_tick();        // nothing placed yet, catch up for free
+
+    t->expires = (stats_now_ns() - wheel_base + ns + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+    if(t->expires <= wheel_now) t->expires = wheel_now + 1;
+    wheel_insert(t);
+    wheel_count++;
+    wheel_program();
+}
+
+void timer_cancel(struct vm_timer* t) {
+    if(!t->next) return;
+    wheel_remove(t);
+    wheel_count--;
+    wheel_program();
+}
+
+int timer_active(void) {
+    return wheel_count != 0;
+}
+
+void timer_expire(void) {
+    if(!wheel_count) return;
+    const uint64_t now = now_tick();
+    if(wheel_next() > now) return;
+
+    wheel_armed = 0;        // setting the timerfd again below also clears its expiry count
+
+    for(uint64_t tick; wheel_count && (tick = wheel_next()) <= now; ) wheel_process(tick);
+    if(now > wheel_now) wheel_now = now;
+    wheel_program();
+}
+
+int timer_wait(int fd) {
+#ifdef __UNIX
+    for(;;) {
+        timer_expire();
+        if(timer_stop) return FALSE;
+
+        struct pollfd p[2] = {{ fd, POLLIN, 0 }, { wheel_fd, POLLIN, 0 }};
+        const int n = poll(p, wheel_fd >= 0 && wheel_count ? 2 : 1, -1);
+        if(n < 0) return errno == EINTR ? TIMER_SIGNALLED : TRUE;     // let the read report an error
+        if(n > 0 && p[0].revents) return TRUE;          // data, EOF or an error
+    }
+#else
+    return !timer_stop;
+#endif
+}
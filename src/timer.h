@@ -0,0 +1,52 @@
+/* Timers of a VM, on a hierarchical timing wheel
+
+Four levels of 64 slots with a 1 ms tick cover about 4.7 hours; a later
+deadline waits in the last level and is placed again each time that
+slot comes round. Arming and cancelling link or unlink a list node,
+O(1) whatever the number of timers. Only slots that hold timers are
+visited, found through one occupancy bitmap per level.
+
+A single timerfd is kept set for the next slot that needs attention, so
+a VM blocked in timer_wait() sleeps in poll() and wakes exactly when
+input arrives or a timer is due. A running VM checks between slices of
+TIMER_SLICE instructions, which costs a clock read, not a system call. */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_SLICE (1 << 20)       // instructions a running VM executes between checks
+
+struct vm_timer {
+    struct vm_timer* next;          // NULL while not armed
+    struct vm_timer* prev;
+    uint64_t expires;               // tick
+    uint8_t level;
+    uint8_t slot;
+    void (*fire)(struct vm_timer* t);
+};
+
+/* Set by a timer that wants the VM to stop: ends timer_wait() and the run */
+extern int timer_stop;
+
+/* Fire t->fire once, ns nanoseconds from now; re-arming moves the deadline */
+void timer_arm(struct vm_timer* t, uint64_t ns);
+
+/* Disarm; harmless if t is not armed */
+void timer_cancel(struct vm_timer* t);
+
+/* Whether any timer is armed */
+int timer_active(void);
+
+/* Fire every timer that is due */
+void timer_expire(void);
+
+/* Returned by timer_wait() when a signal handler ran during the wait */
+#define TIMER_SIGNALLED (-1)
+
+/* Block until fd is readable, firing timers as they come due; FALSE when
+a timer set timer_stop first, TIMER_SIGNALLED when a signal came first */
+int timer_wait(int fd);
+
+#endif
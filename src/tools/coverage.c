@@ -0,0 +1,65 @@
+/*
+    Coverage tool for tyvm: which guest instructions ran, and how often
+    each basic block was entered.
+
+    TYVM_TOOLS=tools/coverage.so[=report-file] ./tyvm-unix <program>
+
+    The report goes to stderr unless a file is given.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../tyvm_tool.h"
+
+struct coverage {
+    uint8_t  executed[UINT16_MAX + 1];
+    uint32_t blocks[UINT16_MAX + 1];
+};
+
+static void on_block(struct tyvm_tool* tool, uint16_t pc) {
+    struct coverage* cov = tool->data;
+    cov->blocks[pc]++;
+}
+
+static void on_insn(struct tyvm_tool* tool, uint16_t pc, uint16_t instr) {
+    struct coverage* cov = tool->data;
+    cov->executed[pc] = 1;
+}
+
+static void on_exit(struct tyvm_tool* tool) {
+    struct coverage* cov = tool->data;
+    FILE* out = *tool->args ? fopen(tool->args, "w") : stderr;
+    if(!out) return;
+
+    unsigned count = 0;
+    for(int pc = 0; pc <= UINT16_MAX; ++pc) count += cov->executed[pc];
+    fprintf(out, "coverage: %u distinct instructions executed\n", count);
+
+    /* executed address ranges */
+    for(int pc = 0; pc <= UINT16_MAX; ++pc) {
+        if(!cov->executed[pc]) continue;
+        int end = pc;
+        while(end < UINT16_MAX && cov->executed[end + 1]) ++end;
+        fprintf(out, "  x%04X-x%04X\n", pc, end);
+        pc = end;
+    }
+
+    fprintf(out, "block entries:\n");
+    for(int pc = 0; pc <= UINT16_MAX; ++pc)
+        if(cov->blocks[pc]) fprintf(out, "  x%04X %u\n", pc, cov->blocks[pc]);
+
+    if(out != stderr) fclose(out);
+}
+
+int tyvm_tool_init(struct tyvm_tool* tool) {
+    if(tool->api != TYVM_TOOL_API) return 0;
+
+    tool->data = calloc(1, sizeof(struct coverage));
+    if(!tool->data) return 0;
+
+    tool->on_block = on_block;
+    tool->on_insn  = on_insn;
+    tool->on_exit  = on_exit;
+    return 1;
+}
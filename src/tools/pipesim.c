@@ -0,0 +1,373 @@
+/*
+    Pipeline model for tyvm: what the program would cost on a classic
+    5-stage LC-3 pipeline (IF ID EX MEM WB) with a branch predictor.
+
+    TYVM_TOOLS=tools/pipesim.so[=options] ./tyvm-unix <program>
+
+    Options are comma separated:
+
+        predictor=static|bimodal|gshare    default gshare; static is
+                                           backward taken, forward not
+        bits=N                             predictor table size, 2^N
+                                           counters (default 12)
+        forward=0                          no bypass network: a result
+                                           is read from the register file
+                                           after write-back
+        out=FILE                           report file, default stderr
+
+    The model is driven by block entries, branch outcomes and traps only,
+    never by single instructions or memory accesses: when a block ends,
+    its instructions are replayed from a decode cache against a register
+    scoreboard. The timing rules:
+
+        - with forwarding, an instruction using the result of the load
+          right before it stalls one cycle; without, any result is ready
+          three cycles after the producer decoded
+        - the condition codes are a register, so a branch on a loaded
+          value pays the load-use stall
+        - LDI and STI use MEM twice and stall the next instruction once
+        - there is no BTB: a direct branch or JSR predicted taken costs
+          one bubble, its target being known at the end of ID
+        - conditional branches resolve in EX: a misprediction flushes
+          two slots, and so does every JMP, RET, JSRR and TRAP, whose
+          target comes from a register or the trap vector
+
+    Trap routines run on the host and cost nothing beyond their flush.
+    Stores into code are seen: the replay checks each cached decode
+    against the word in memory and decodes it again if they differ.
+
+    The report gives cycles, CPI and prediction accuracy, then one line
+    per instruction that stalled, caused a flush or was predicted:
+
+        x3010 BR stalls 0 flushed 40 branches 100 mispredicted 20
+*/
+
+#define _POSIX_C_SOURCE 200809L     // strdup
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../tyvm_tool.h"
+
+#define PS_COND         8       // condition codes, scoreboarded like a register
+#define PS_REGS         9
+#define PS_MISPREDICT   2       // slots flushed when EX redirects fetch
+#define PS_TAKEN        1       // ... when ID does
+
+enum kind {
+    K_PLAIN,
+    K_NEVER,                    // BR with no condition: a NOP, but it ends the VM's block
+    K_COND,                     // conditional BR
+    K_DIRECT,                   // BRnzp, JSR
+    K_INDIRECT,                 // JMP, RET, JSRR, TRAP
+    K_ILLEGAL                   // RTI, reserved: the VM stops there
+};
+
+enum predictor { P_STATIC, P_BIMODAL, P_GSHARE };
+
+struct decoded {
+    uint16_t instr;             // the word it was decoded from
+    uint16_t src;               // registers read, bit PS_COND for the flags
+    uint16_t dst;
+    uint8_t kind;
+    uint8_t latency;            // cycles until dst can be consumed, counted from ID
+    uint8_t mem2;               // uses MEM twice
+    uint8_t valid;
+};
+
+struct pipesim {
+    struct decoded insn[UINT16_MAX + 1];
+
+    uint64_t stalls[UINT16_MAX + 1];
+    uint64_t flushed[UINT16_MAX + 1];
+    uint64_t branches[UINT16_MAX + 1];
+    uint64_t mispredicted[UINT16_MAX + 1];
+
+    int forward;
+    enum predictor predictor;
+    int bits;
+    uint8_t* counters;          // 2-bit saturating
+    uint32_t history;
+    const char* out;
+
+    uint64_t cycle;             // ID cycle of the next instruction
+    uint64_t ready[PS_REGS];    // first ID cycle that can consume each register
+    uint64_t instructions;
+    uint16_t block;             // start of the block executing now
+    int bubbles;                // left by the branch that ended it
+};
+
+static void decode(struct pipesim* ps, uint16_t pc, uint16_t instr) {
+    struct decoded* d = &ps->insn[pc];
+    memset(d, 0, sizeof(*d));
+    d->instr = instr;
+    d->valid = 1;
+
+    const int dr   = (instr >> 9) & 7;
+    const int sr1  = (instr >> 6) & 7;
+    const int load = ps->forward ? 2 : 3;
+    const int alu  = ps->forward ? 1 : 3;
+
+    switch(instr >> 12) {
+        case 0x1:   // ADD
+        case 0x5:   // AND
+            d->src = 1 << sr1 | ((instr >> 5) & 1 ? 0 : 1 << (instr & 7));
+            d->dst = 1 << dr | 1 << PS_COND;
+            d->latency = alu;
+            break;
+        case 0x9:   // NOT
+            d->src = 1 << sr1;
+            d->dst = 1 << dr | 1 << PS_COND;
+            d->latency = alu;
+            break;
+        case 0xE:   // LEA
+            d->dst = 1 << dr | 1 << PS_COND;
+            d->latency = alu;
+            break;
+        case 0x2:   // LD
+        case 0x6:   // LDR
+        case 0xA:   // LDI
+            d->src = (instr >> 12) == 0x6 ? 1 << sr1 : 0;
+            d->dst = 1 << dr | 1 << PS_COND;
+            d->mem2 = (instr >> 12) == 0xA;
+            d->latency = load + d->mem2;
+            break;
+        case 0x3:   // ST
+        case 0xB:   // STI
+            d->src = 1 << dr;
+            d->mem2 = (instr >> 12) == 0xB;
+            break;
+        case 0x7:   // STR
+            d->src = 1 << dr | 1 << sr1;
+            break;
+        case 0x0:   // BR
+            switch(dr) {
+                case 0: d->kind = K_NEVER;  break;
+                case 7: d->kind = K_DIRECT; break;
+                default:
+                    d->kind = K_COND;
+                    d->src  = 1 << PS_COND;
+                    break;
+            }
+            break;
+        case 0x4:   // JSR, JSRR
+            d->kind = (instr >> 11) & 1 ? K_DIRECT : K_INDIRECT;
+            d->src  = (instr >> 11) & 1 ? 0 : 1 << sr1;
+            d->dst  = 1 << 7;
+            d->latency = alu;
+            break;
+        case 0xC:   // JMP, RET
+            d->kind = K_INDIRECT;
+            d->src  = 1 << sr1;
+            break;
+        case 0xF:   // TRAP: the routines read R0 and may write it
+            d->kind = K_INDIRECT;
+            d->src  = 1 << 0;
+            d->dst  = 1 << 0 | 1 << 7 | 1 << PS_COND;
+            d->latency = load;
+            break;
+        default:
+            d->kind = K_ILLEGAL;
+            break;
+    }
+}
+
+/* The decoded instruction at pc, decoded again if a store changed it */
+static const struct decoded* lookup(struct pipesim* ps, uint16_t pc, uint16_t instr) {
+    struct decoded* d = &ps->insn[pc];
+    if(!d->valid || d->instr != instr) decode(ps, pc, instr);
+    return d;
+}
+
+/* Replay the current block up to its branch, or up to stop if the VM
+halted inside it */
+static void replay(struct tyvm_tool* tool, int stop) {
+    struct pipesim* ps = tool->data;
+    uint16_t pc = ps->block;
+
+    for(;;) {
+        if(pc == stop) break;
+        const struct decoded* d = lookup(ps, pc, tool->memory[pc]);
+        if(d->kind == K_ILLEGAL) break;
+
+        uint64_t issue = ps->cycle;
+        for(uint16_t src = d->src; src; src &= src - 1) {
+            const uint64_t ready = ps->ready[__builtin_ctz(src)];
+            if(ready > issue) issue = ready;
+        }
+        ps->stalls[pc] += issue - ps->cycle;
+
+        for(uint16_t dst = d->dst; dst; dst &= dst - 1) ps->ready[__builtin_ctz(dst)] = issue + d->latency;
+        ps->cycle = issue + 1;
+        if(d->mem2) {
+            ps->cycle++;
+            ps->stalls[pc]++;
+        }
+        ps->instructions++;
+
+        if(d->kind != K_PLAIN) break;
+        ++pc;
+    }
+
+    ps->cycle += ps->bubbles;           // the slots the branch flushed
+    ps->bubbles = 0;
+}
+
+static int predict(struct pipesim* ps, uint16_t pc, uint16_t instr) {
+    switch(ps->predictor) {
+        case P_STATIC:  return instr & 0x100;           // negative offset: a loop
+        case P_BIMODAL: return ps->counters[pc & ((1u << ps->bits) - 1)] >= 2;
+        default:        return ps->counters[(pc ^ ps->history) & ((1u << ps->bits) - 1)] >= 2;
+    }
+}
+
+static void train(struct pipesim* ps, uint16_t pc, int taken) {
+    if(ps->predictor == P_STATIC) return;
+
+    const uint32_t mask = (1u << ps->bits) - 1;
+    uint8_t* c = &ps->counters[(ps->predictor == P_GSHARE ? pc ^ ps->history : pc) & mask];
+    if(taken && *c < 3) ++*c;
+    if(!taken && *c > 0) --*c;
+    ps->history = (ps->history << 1 | (taken != 0)) & mask;
+}
+
+static void on_branch(struct tyvm_tool* tool, uint16_t pc, uint16_t target, int taken) {
+    struct pipesim* ps = tool->data;
+
+    switch(lookup(ps, pc, tool->memory[pc])->kind) {
+        case K_COND: {
+            const int predicted = predict(ps, pc, tool->memory[pc]) != 0;
+            train(ps, pc, taken);
+            ps->branches[pc]++;
+            if(predicted != (taken != 0)) {
+                ps->mispredicted[pc]++;
+                ps->bubbles = PS_MISPREDICT;
+            } else ps->bubbles = taken ? PS_TAKEN : 0;
+            break;
+        }
+        case K_DIRECT:
+            ps->bubbles = PS_TAKEN;
+            break;
+        case K_INDIRECT:
+            ps->bubbles = PS_MISPREDICT;
+            break;
+        default:
+            ps->bubbles = 0;
+            break;
+    }
+    ps->flushed[pc] += ps->bubbles;
+}
+
+static void on_trap(struct tyvm_tool* tool, uint16_t pc, uint8_t trapvect) {
+    struct pipesim* ps = tool->data;
+    if(trapvect == 0x25) return;        // HALT: nothing is fetched after it
+    ps->bubbles = PS_MISPREDICT;
+    ps->flushed[pc] += PS_MISPREDICT;
+}
+
+static void on_block(struct tyvm_tool* tool, uint16_t pc) {
+    struct pipesim* ps = tool->data;
+    if(ps->cycle) replay(tool, -1);     // the first call starts the program
+    else ps->cycle = 1;                 // instruction 0 decodes after one fetch
+    ps->block = pc;
+}
+
+static void on_exit(struct tyvm_tool* tool) {
+    struct pipesim* ps = tool->data;
+
+    /* HALT ends the last block; a VM stopped early has PC inside it */
+    replay(tool, tool->reg[8]);
+
+    FILE* out = ps->out ? fopen(ps->out, "w") : stderr;
+    if(!out) return;
+
+    static const char* predictors[] = { "static", "bimodal", "gshare" };
+    static const char* names[16] = { "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+                                     "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP" };
+
+    uint64_t stalls = 0, flushed = 0, branches = 0, mispredicted = 0;
+    for(int pc = 0; pc <= UINT16_MAX; ++pc) {
+        stalls       += ps->stalls[pc];
+        flushed      += ps->flushed[pc];
+        branches     += ps->branches[pc];
+        mispredicted += ps->mispredicted[pc];
+    }
+    const uint64_t cycles = ps->instructions ? ps->cycle - 1 + 4 : 0;    // drain EX, MEM, WB
+
+    fprintf(out, "# tyvm pipeline 1\n");
+    fprintf(out, "pipeline 5-stage %s, predictor %s", ps->forward ? "forwarding" : "no forwarding", predictors[ps->predictor]);
+    if(ps->predictor != P_STATIC) fprintf(out, " %d bits", ps->bits);
+    fprintf(out, "\n");
+    fprintf(out, "instructions %lu cycles %lu CPI %.3f\n", (unsigned long)ps->instructions, (unsigned long)cycles,
+            ps->instructions ? (double)cycles / ps->instructions : 0.0);
+    fprintf(out, "stalls %lu flushed %lu branches %lu mispredicted %lu (%.2f%%)\n", (unsigned long)stalls, (unsigned long)flushed,
+            (unsigned long)branches, (unsigned long)mispredicted, branches ? 100.0 * mispredicted / branches : 0.0);
+
+    for(int pc = 0; pc <= UINT16_MAX; ++pc) {
+        if(!ps->stalls[pc] && !ps->flushed[pc] && !ps->branches[pc]) continue;
+        fprintf(out, "x%04X %s stalls %lu flushed %lu branches %lu mispredicted %lu\n", pc, names[tool->memory[pc] >> 12],
+                (unsigned long)ps->stalls[pc], (unsigned long)ps->flushed[pc],
+                (unsigned long)ps->branches[pc], (unsigned long)ps->mispredicted[pc]);
+    }
+
+    if(out != stderr) fclose(out);
+}
+
+/* predictor=..., bits=..., forward=..., out=... */
+static int parse_args(struct pipesim* ps, const char* args) {
+    char* copy = strdup(args);          // out points into it, never freed
+    if(!copy) return 0;
+
+    for(char* opt = strtok(copy, ","); opt; opt = strtok(NULL, ",")) {
+        char* val = strchr(opt, '=');
+        if(!val) {
+            fprintf(stderr, "pipesim: option %s needs a value\n", opt);
+            return 0;
+        }
+        *val++ = '\0';
+
+        if(!strcmp(opt, "predictor")) {
+            if(!strcmp(val, "static"))       ps->predictor = P_STATIC;
+            else if(!strcmp(val, "bimodal")) ps->predictor = P_BIMODAL;
+            else if(!strcmp(val, "gshare"))  ps->predictor = P_GSHARE;
+            else {
+                fprintf(stderr, "pipesim: unknown predictor %s\n", val);
+                return 0;
+            }
+        } else if(!strcmp(opt, "bits")) {
+            ps->bits = atoi(val);
+            if(ps->bits < 1 || ps->bits > 16) {
+                fprintf(stderr, "pipesim: bits must be 1 to 16\n");
+                return 0;
+            }
+        } else if(!strcmp(opt, "forward")) ps->forward = atoi(val) != 0;
+        else if(!strcmp(opt, "out")) ps->out = val;
+        else {
+            fprintf(stderr, "pipesim: unknown option %s\n", opt);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int tyvm_tool_init(struct tyvm_tool* tool) {
+    if(tool->api != TYVM_TOOL_API) return 0;
+
+    struct pipesim* ps = calloc(1, sizeof(struct pipesim));
+    if(!ps) return 0;
+    ps->forward   = 1;
+    ps->predictor = P_GSHARE;
+    ps->bits      = 12;
+    if(!parse_args(ps, tool->args)) return 0;
+
+    ps->counters = malloc(1u << ps->bits);
+    if(!ps->counters) return 0;
+    memset(ps->counters, 1, 1u << ps->bits);    // weakly not taken
+
+    tool->data      = ps;
+    tool->on_block  = on_block;
+    tool->on_branch = on_branch;
+    tool->on_trap   = on_trap;
+    tool->on_exit   = on_exit;
+    return 1;
+}
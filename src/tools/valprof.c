@@ -0,0 +1,205 @@
+/*
+    Value profiling tool for tyvm: which values a program keeps seeing,
+    as input for specialising it (see tyvm-opt -p).
+
+    TYVM_TOOLS=tools/valprof.so[=profile-file] ./tyvm-unix <program>
+
+    Records, per basic block, the registers that held the same value at
+    every entry; per computed jump (JMP Rn, JSRR), the targets it took;
+    and per load (LD, LDR, LDI), whether it always returned the same
+    value from memory the program never wrote. The profile goes to stderr
+    unless a file is given; every line is one fact:
+
+        block x3010 hits 120 R1=x0004 R5=x4000
+        indirect x3022 JSRR hits 50 x3100:30 x3140:20 other:0
+        load x3007 LDR hits 100 x0010 from x4000-x4000
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../tyvm_tool.h"
+
+#define VP_MIN_HITS     2       // a block entered once has every register "constant"
+#define VP_MAX_TARGETS  8       // targets kept per jump site, the rest count as other
+#define VP_PAGE_SHIFT   8       // write tracking granularity, 256 words
+
+struct block_prof {
+    uint64_t hits;
+    uint16_t val[8];
+    uint8_t varies;             // registers that took a second value
+};
+
+struct site_prof {
+    uint64_t hits;
+    int targets;
+    uint16_t target[VP_MAX_TARGETS];
+    uint64_t count[VP_MAX_TARGETS];
+    uint64_t other;
+};
+
+struct load_prof {
+    uint64_t hits;
+    uint16_t val;
+    uint16_t addr_lo;
+    uint16_t addr_hi;
+    int varies;
+};
+
+struct valprof {
+    struct block_prof* blocks[UINT16_MAX + 1];
+    struct site_prof* sites[UINT16_MAX + 1];
+    struct load_prof* loads[UINT16_MAX + 1];
+    uint8_t written[(UINT16_MAX + 1) >> VP_PAGE_SHIFT];
+
+    /* the load executing now: its last data read is the loaded value,
+    an LDI also reads the pointer */
+    int load_pc;                // -1 when the current instruction is not a load
+    int have_read;
+    uint16_t read_lo;
+    uint16_t read_hi;
+    uint16_t read_val;
+};
+
+static void* lazy(void** slot, size_t size) {
+    if(!*slot) *slot = calloc(1, size);
+    return *slot;
+}
+
+static void on_block(struct tyvm_tool* tool, uint16_t pc) {
+    struct valprof* vp = tool->data;
+    struct block_prof* b = lazy((void**)&vp->blocks[pc], sizeof(*b));
+    if(!b) return;
+
+    if(b->hits++ == 0) {
+        for(int r = 0; r < 8; ++r) b->val[r] = tool->reg[r];
+        return;
+    }
+    for(int r = 0; r < 8; ++r)
+        if(b->val[r] != tool->reg[r]) b->varies |= 1 << r;
+}
+
+static void on_branch(struct tyvm_tool* tool, uint16_t pc, uint16_t target, int taken) {
+    const uint16_t instr = tool->memory[pc];
+    const int jmp  = (instr >> 12) == 0xC && ((instr >> 6) & 7) != 7;     // JMP, not RET
+    const int jsrr = (instr >> 12) == 0x4 && !((instr >> 11) & 1);
+    if(!jmp && !jsrr) return;
+
+    struct valprof* vp = tool->data;
+    struct site_prof* s = lazy((void**)&vp->sites[pc], sizeof(*s));
+    if(!s) return;
+
+    s->hits++;
+    for(int t = 0; t < s->targets; ++t) {
+        if(s->target[t] != target) continue;
+        s->count[t]++;
+        return;
+    }
+    if(s->targets == VP_MAX_TARGETS) {
+        s->other++;
+        return;
+    }
+    s->target[s->targets] = target;
+    s->count[s->targets++] = 1;
+}
+
+/* Account the load that just finished */
+static void commit_load(struct valprof* vp) {
+    if(vp->load_pc < 0 || !vp->have_read || vp->read_hi >= 0xFE00) return;     // devices are never constant
+
+    struct load_prof* l = lazy((void**)&vp->loads[vp->load_pc], sizeof(*l));
+    if(!l) return;
+
+    if(l->hits++ == 0) {
+        l->val = vp->read_val;
+        l->addr_lo = vp->read_lo;
+        l->addr_hi = vp->read_hi;
+        return;
+    }
+    if(l->val != vp->read_val) l->varies = 1;
+    if(vp->read_lo < l->addr_lo) l->addr_lo = vp->read_lo;
+    if(vp->read_hi > l->addr_hi) l->addr_hi = vp->read_hi;
+}
+
+static void on_insn(struct tyvm_tool* tool, uint16_t pc, uint16_t instr) {
+    struct valprof* vp = tool->data;
+    commit_load(vp);
+
+    const uint16_t op = instr >> 12;
+    vp->load_pc   = op == 0x2 || op == 0x6 || op == 0xA ? pc : -1;      // LD, LDR, LDI
+    vp->have_read = 0;
+}
+
+static void on_mem_read(struct tyvm_tool* tool, uint16_t address, uint16_t val) {
+    struct valprof* vp = tool->data;
+    if(!vp->have_read || address < vp->read_lo) vp->read_lo = address;
+    if(!vp->have_read || address > vp->read_hi) vp->read_hi = address;
+    vp->have_read = 1;
+    vp->read_val  = val;
+}
+
+static void on_mem_write(struct tyvm_tool* tool, uint16_t address, uint16_t val) {
+    struct valprof* vp = tool->data;
+    vp->written[address >> VP_PAGE_SHIFT] = 1;
+}
+
+static int range_written(const struct valprof* vp, uint16_t lo, uint16_t hi) {
+    for(int page = lo >> VP_PAGE_SHIFT; page <= hi >> VP_PAGE_SHIFT; ++page)
+        if(vp->written[page]) return 1;
+    return 0;
+}
+
+static void on_exit(struct tyvm_tool* tool) {
+    struct valprof* vp = tool->data;
+    commit_load(vp);
+    vp->load_pc = -1;
+
+    FILE* out = *tool->args ? fopen(tool->args, "w") : stderr;
+    if(!out) return;
+
+    fprintf(out, "# tyvm value profile 1\n");
+
+    for(int pc = 0; pc <= UINT16_MAX; ++pc) {
+        const struct block_prof* b = vp->blocks[pc];
+        if(!b || b->hits < VP_MIN_HITS || b->varies == 0xFF) continue;
+        fprintf(out, "block x%04X hits %lu", pc, (unsigned long)b->hits);
+        for(int r = 0; r < 8; ++r)
+            if(!(b->varies >> r & 1)) fprintf(out, " R%d=x%04X", r, b->val[r]);
+        fprintf(out, "\n");
+    }
+
+    for(int pc = 0; pc <= UINT16_MAX; ++pc) {
+        const struct site_prof* s = vp->sites[pc];
+        if(!s) continue;
+        fprintf(out, "indirect x%04X %s hits %lu", pc, (tool->memory[pc] >> 12) == 0xC ? "JMP" : "JSRR", (unsigned long)s->hits);
+        for(int t = 0; t < s->targets; ++t) fprintf(out, " x%04X:%lu", s->target[t], (unsigned long)s->count[t]);
+        fprintf(out, " other:%lu\n", (unsigned long)s->other);
+    }
+
+    for(int pc = 0; pc <= UINT16_MAX; ++pc) {
+        const struct load_prof* l = vp->loads[pc];
+        if(!l || l->hits < VP_MIN_HITS || l->varies || range_written(vp, l->addr_lo, l->addr_hi)) continue;
+        static const char* names[16] = { [0x2] = "LD", [0x6] = "LDR", [0xA] = "LDI" };
+        fprintf(out, "load x%04X %s hits %lu x%04X from x%04X-x%04X\n", pc, names[tool->memory[pc] >> 12] ? names[tool->memory[pc] >> 12] : "?",
+                (unsigned long)l->hits, l->val, l->addr_lo, l->addr_hi);
+    }
+
+    if(out != stderr) fclose(out);
+}
+
+int tyvm_tool_init(struct tyvm_tool* tool) {
+    if(tool->api != TYVM_TOOL_API) return 0;
+
+    struct valprof* vp = calloc(1, sizeof(struct valprof));
+    if(!vp) return 0;
+    vp->load_pc = -1;
+
+    tool->data         = vp;
+    tool->on_block     = on_block;
+    tool->on_branch    = on_branch;
+    tool->on_insn      = on_insn;
+    tool->on_mem_read  = on_mem_read;
+    tool->on_mem_write = on_mem_write;
+    tool->on_exit      = on_exit;
+    return 1;
+}
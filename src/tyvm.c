@@ -4,9 +4,25 @@
     Open-source software distributed under GNU GPL v.3 license
 */
 
-#include "preprocessor.c"
-#include "registers.c"
+#include "preprocessor.h"
+#include "registers.h"
 #include "lc3_lib.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "instrument.h"
+#include "timer.h"
+#include "idle.h"
+#include "vm.h"
+#include "canary.h"
+#include "numa.h"
+#include "pace.h"
+
+/* TYVM_TIME_LIMIT: wall-clock seconds the guest may run */
+static void time_up(struct vm_timer* t) {
+    timer_stop = TRUE;
+}
+
+static struct vm_timer time_limit = { .fire = time_up };
 
 int main(int argc, const char* argv[]) {
     if(argc != 2) {
@@ -14,232 +30,54 @@ int main(int argc, const char* argv[]) {
         exit(2);
     }
 
+    /* TYVM_CPU: pin before the image is read, so the guest pages are
+    first touched, and allocated, on the node of those CPUs */
+    const char* cpus = getenv("TYVM_CPU");
+    if(cpus && *cpus && !numa_pin_list(cpus)) fprintf(stderr, "tyvm: cannot run on CPUs %s\n", cpus);
+
     if(!read_image(argv[1])) {
         printf("failed to load image: %s\n", argv[2]);
         exit(1);
     }
 
-    signal(SIGINT, handle_interrupt);
-    disable_input_buffering();
-
-    reg[RG_COND] = FL_Z;
-
-    enum {PC_START = 0x3000};
-    reg[RG_PC] = PC_START;          //0x3000 is default load address
-
-    int running = TRUE;
-    while(running) {
-        const uint16_t instr = mem_read(reg[RG_PC]++);
-        const uint16_t op    = instr >> 12;
-
-        static uint16_t cond;   // condition flag status
-        static uint16_t PCoffset9;     // 9-bit value that indicates where to load the address when added to PC register
-        static uint16_t PCoffset11;    // 11-bit value that indicates where to load the address when added to PC register
-        static uint16_t dr;            // destination register
-        static uint16_t sr;            // source register
-        static uint16_t sr1;           // source register 1
-        static uint16_t sr2;           // source register 2
-        static uint16_t imm_flag;      // immediate mode flag (bit[5])
-        static uint16_t imm5;          // immediate mode 5 bit value
-        static uint16_t jsr_flag;      // JSR flag
-        static uint16_t BaseR_jsr;
-        static uint16_t BaseR_jsrr;
-        static uint16_t BaseR;
-        static uint16_t offset6;       // 6-bit offset value
-
-        static uint16_t* stringPnt;
-        static uint16_t* c;
-        static uint16_t* ch;
-
-        switch (op) {
-            case OP_BR:
-                cond      = (instr >> 9) & 0x7;
-                PCoffset9 = sign_extend(instr & 0x1FF, 9);
-
-                if(cond & reg[RG_COND]) reg[RG_PC] += PCoffset9;
-
-                break;
-            case OP_ADD:
-                dr       = (instr >> 9) & 0x7;
-                sr1      = (instr >> 6) & 0x7;
-                imm_flag = (instr >> 5) & 0x1;
+    stats_init();
+    canary_init(argv[1]);
 
-                if(imm_flag == 0) {
-                    sr2 = (instr & 0x7);
-                    reg[dr] = reg[sr1] + sr2;            // register mode add
-                } else {
-                    imm5 = sign_extend(instr & 0x1F, 5);
-                    reg[dr] = reg[sr1] + imm5;           // immediate mode add
-                }
+    const char* limit = getenv("TYVM_TIME_LIMIT");
+    if(limit && atof(limit) > 0) timer_arm(&time_limit, (uint64_t)(atof(limit) * 1e9));
+    idle_init();
+    pace_init();
 
-                update_flags(dr);
+    if(stats_shared()) arm_interrupt();     // the terminal arms it on first input
+    snapshot_init();
 
-                break;
-            case OP_LD:
-                dr        = (instr >> 9) & 0x7;
-                PCoffset9 = sign_extend(instr & 0x1FF, 9);
+    if(!instrument_init()) exit(1);
 
-                reg[dr] = mem_read(PCoffset9 + reg[RG_PC]);
+    vm_reset(PC_START);             //0x3000 is default load address
 
-                update_flags(dr);
+    stats->state = VS_RUNNING;
+    if(instrument_mask & HOOK_BLOCK) instrument_block(PC_START);
 
-                break;
-            case OP_ST:
-                sr        = (instr >> 6) & 0x7;
-                PCoffset9 = sign_extend(instr & 0x1FF, 9);     // 9-bit value that indicates where to load the address when added to RG_PC
-
-                reg[sr] = mem_read(PCoffset9 + reg[RG_PC]);
-
-                update_flags(dr);
-
-                break;
-            case OP_JSR:
-                PCoffset11  = sign_extend(instr & 0x1FF, 11);
-                jsr_flag    = (instr >> 11) & 0x1;
-                BaseR_jsrr  = (instr >> 6) & 0x7;          // JSRR only ecoding
+    stats_mark();
+    enum vm_exit status = VM_LIMIT;
+    const uint64_t paced = pace_slice();
+    while(!timer_stop && (status = vm_run(paced ? paced : timer_active() ? TIMER_SLICE : UINT64_MAX)) == VM_LIMIT) {
+        timer_expire();
+        pace_wait();
+    }
+    stats_mark();
 
-                if(jsr_flag == 0) reg[RG_PC] = BaseR_jsrr;          // JSRR
-                else reg[RG_PC] += PCoffset11;                      // JSR
+    stats->state = VS_HALTED;
+    if(instrument_mask & HOOK_EXIT) instrument_exit();
 
-                break;
-            case OP_AND:
-                dr       = (instr >> 9) & 0x7;
-                sr1      = (instr >> 6) & 0x7;
-                imm_flag = (instr >> 5) & 0x1;
+    release_terminal();         //restore terminal settings when shutdown
+    pace_report();
+    stats_close();
+    canary_finish(status);
 
-                if(imm_flag == 0) {
-                    sr2 = (instr & 0x7);
-                    reg[dr] = reg[sr1] & sr2;            // register mode and
-                } else {
-                    imm5 = sign_extend(instr & 0x1F, 5);
-                    reg[dr] = reg[sr1] & imm5;           // immediate mode and
-                }
-
-                update_flags(dr);
-
-                break;
-            case OP_LDR:
-                dr      = (instr >> 9) & 0x7;
-                BaseR   = (instr >> 6) & 0x7;
-                offset6 = sign_extend(instr & 0x3FF, 6);
-
-                reg[dr] = mem_read(reg[BaseR] + offset6);
-
-                update_flags(dr);
-
-                break;
-            case OP_STR:
-                sr      = (instr >> 6) & 0x7;
-                BaseR   = (instr >> 6) & 0x7;
-                offset6 = sign_extend(instr & 0x1FF, 6);
-
-                reg[sr] = mem_read(offset6 + BaseR);        //TODO: check if reg[] is needed
-
-                update_flags(dr);
-
-                break;
-            case OP_NOT:
-                dr = (instr >> 9) & 0x7;   // destination register
-                sr = (instr >> 6) & 0x7;   // source register
-
-                reg[dr] = ~(reg[sr]);
-
-                update_flags(dr);
-
-                break;
-            case OP_LDI:
-                dr        = (instr >> 9) & 0x7;
-                PCoffset9 = sign_extend(instr & 0x1FF, 9);
-
-                reg[dr] = mem_read(mem_read(PCoffset9 + reg[RG_PC]));
-
-                update_flags(dr);
-
-                break;
-            case OP_STI:
-                sr        = (instr >> 6) & 0x7;
-                PCoffset9 = sign_extend(instr & 0x1FF, 9);     // 9-bit value that indicates where to load the address when added to RG_PC
-
-                reg[sr] = mem_read(mem_read(PCoffset9 + reg[RG_PC]));
-
-                update_flags(dr);
-
-                break;
-            case OP_JMP:
-                BaseR = (instr >> 6) & 0x7;
-
-                reg[RG_PC] = reg[BaseR];
-
-                update_flags(dr);
-
-                break;
-            case OP_LEA:
-                dr = (instr >> 9) & 0x7;
-                PCoffset9 = sign_extend(instr & 0x1FF, 9);
-
-                reg[dr] = reg[RG_PC] + PCoffset9;
-
-                update_flags(dr);
-
-                break;
-            case OP_TRAP:
-                switch(instr & 0xFF) {
-                    case TC_GETC:
-                        reg[RG_R0] = (uint16_t)getchar();
-                        break;
-                    case TC_OUT:
-                        putc((char)reg[RG_R0], stdout);
-                        fflush(stdout);
-                        break;
-                    case TC_PUTS:
-                        stringPnt = memory + reg[RG_R0];
-
-                        while (*c) {
-                            putc((char)*c, stdout);
-                            ++c;
-                        }
-                        fflush(stdout);
-
-                        break;
-                    case TC_IN:
-                        printf("Enter a character: ");
-                        char c = getchar();
-                        putc(c, stdout);
-                        fflush(stdout);
-
-                        reg[RG_R0] = (uint16_t)c;
-                        update_flags(RG_R0);
-
-                        break;
-                    case TC_PUTSP:
-                        ch = memory + reg[RG_R0];
-                        while (*ch) {
-                            char char1 = (*ch) & 0xFF;
-                            putc(char1, stdout);
-                            char char2 = (*ch) >> 8;
-                            if (char2) putc(char2, stdout);
-                            ++ch;
-                        }
-                        fflush(stdout);
-
-                        break;
-                    case TC_HALT:
-                        puts("HALT");
-                        fflush(stdout);
-                        running = FALSE;
-
-                        break;
-                    default:
-                        abort();
-                        break;
-                }
-                break;
-            case OP_RES:    // reserved
-            case OP_RTI:    // unused
-            default:
-                abort();
-                break;
-        }
+    if(status == VM_ILLEGAL) abort();
+    if(status == VM_LIMIT) {
+        fprintf(stderr, "tyvm: time limit reached\n");
+        exit(3);
     }
-    restore_input_buffering();  //restore terminal settings when shutdown
 }
\ No newline at end of file
@@ -0,0 +1,549 @@
+/*
+    tyvm-as: LC-3 assembler and parallel batch driver.
+    Copyright (c) 2022 Erick Ahmed
+    Open-source software distributed under GNU GPL v.3 license
+
+    Usage:
+        tyvm-as prog.asm [-o prog.obj]                          one image
+        tyvm-as [-j jobs] [-c cache] -o batch.tya source...     a batch
+
+    A source is an .asm file, a directory (searched for .asm files) or an
+    uncompressed tar archive of them. Batches are assembled by -j worker
+    processes (default: one per usable core), and land in one indexed
+    archive (see archive.h) under each source's path relative to the
+    directory or tar it came from.
+
+    On a NUMA machine the workers are pinned round-robin over the nodes,
+    so everything a worker allocates comes from its own node. Each node
+    has its own queue, a share of the sources sized to its workers; a
+    worker that runs dry steals from the other queues, nearest node first.
+
+    Every result, errors included, is cached by a hash of the source in
+    the cache directory (-c, else $TYVM_CACHE, else ~/.cache/tyvm), so an
+    unchanged source is never assembled twice. A cache entry is one file
+    holding the source and its result, published by a single rename, and
+    its source is compared on every hit, so a hash collision costs a
+    reassembly, never a wrong image. The archive is built from the bytes
+    each job produced, which the workers spool to the parent, never from
+    the cache.
+*/
+
+#include "preprocessor.h"
+#include "lc3as.h"
+#include "archive.h"
+#include "numa.h"
+
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define TAR_BLOCK 512
+
+struct source {
+    char* name;             // key in the archive
+    char* path;             // file to read, NULL when data points into a tar
+    const char* data;
+    size_t len;
+};
+
+/* Filled in by the workers, in memory shared with the parent */
+struct job {
+    uint64_t hash;
+    uint32_t status;        // enum tya_status
+    uint32_t cached;
+    uint32_t spool;         // worker whose spool holds the image or error text
+    uint32_t length;
+    uint64_t offset;        // in that spool
+};
+
+/* A cache file: this header, the source, then the image or error text */
+struct cache_entry {
+    uint32_t status;        // enum tya_status
+    uint32_t reserved;
+    uint64_t source_len;
+    uint64_t result_len;
+};
+
+/* The sources of one node, jobs[next .. end) still to take; a cache line
+each, so the nodes never write to the same one */
+struct queue {
+    atomic_uint next;
+    unsigned end;
+    char pad[64 - sizeof(atomic_uint) - sizeof(unsigned)];
+};
+
+static struct source* sources;
+static int source_count;
+static int source_cap;
+
+static const char* cache_dir;
+static struct lc3as_result result;
+static FILE** spools;       // one per worker, read back by the parent
+static FILE* spool;         // this worker's
+static uint32_t spool_index;
+static struct numa_topology topo;
+
+static void add_source(const char* name, const char* path, const char* data, size_t len) {
+    if(source_count == source_cap) {
+        source_cap = source_cap ? source_cap * 2 : 256;
+        sources = realloc(sources, source_cap * sizeof(*sources));
+    }
+    struct source* s = &sources[source_count++];
+    s->name = strdup(name);
+    s->path = path ? strdup(path) : NULL;
+    s->data = data;
+    s->len  = len;
+}
+
+static int is_asm(const char* name) {
+    size_t n = strlen(name);
+    return n > 4 && strcasecmp(name + n - 4, ".asm") == 0;
+}
+
+/* Collect the .asm files under dir, named relative to root */
+static void add_directory(const char* dir, size_t root) {
+    DIR* d = opendir(dir);
+    if(!d) return;
+
+    struct dirent* e;
+    while((e = readdir(d))) {
+        if(e->d_name[0] == '.') continue;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+
+        struct stat st;
+        if(stat(path, &st) != 0) continue;
+        if(S_ISDIR(st.st_mode)) add_directory(path, root);
+        else if(S_ISREG(st.st_mode) && is_asm(e->d_name)) add_source(path + root, path, NULL, 0);
+    }
+    closedir(d);
+}
+
+static uint64_t tar_number(const char* p, size_t n) {
+    uint64_t v = 0;
+    for(; n && *p == ' '; --n, ++p);
+    for(; n && *p >= '0' && *p <= '7'; --n, ++p) v = v * 8 + (*p - '0');
+    return v;
+}
+
+/* Collect the .asm members of a tar; the data stays in the mapping */
+static int add_tar(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) return FALSE;
+
+    const char* tar = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(tar == MAP_FAILED) return FALSE;
+
+    char long_name[4096] = "";
+    for(size_t off = 0; off + TAR_BLOCK <= (size_t)st.st_size; ) {
+        const char* h = tar + off;
+        if(h[0] == '\0') break;         // end of archive
+
+        const uint64_t size = tar_number(h + 124, 12);
+        const char type = h[156];
+        const char* data = h + TAR_BLOCK;
+        off += TAR_BLOCK + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+        if(off > (size_t)st.st_size) break;
+
+        if(type == 'L') {               // GNU long name for the next member
+            snprintf(long_name, sizeof(long_name), "%.*s", (int)size, data);
+            continue;
+        }
+
+        char name[4096];
+        if(long_name[0]) snprintf(name, sizeof(name), "%s", long_name);
+        else if(memcmp(h + 257, "ustar", 5) == 0 && h[345]) snprintf(name, sizeof(name), "%.155s/%.100s", h + 345, h);
+        else snprintf(name, sizeof(name), "%.100s", h);
+        long_name[0] = '\0';
+
+        const char* key = strncmp(name, "./", 2) == 0 ? name + 2 : name;
+        if((type == '0' || type == '\0') && is_asm(key)) add_source(key, NULL, data, size);
+    }
+    return TRUE;
+}
+
+static void add_input(const char* arg) {
+    struct stat st;
+    if(stat(arg, &st) != 0) {
+        fprintf(stderr, "tyvm-as: cannot open %s\n", arg);
+        exit(1);
+    }
+
+    if(S_ISDIR(st.st_mode)) {
+        size_t root = strlen(arg);
+        while(root > 1 && arg[root - 1] == '/') --root;
+        char dir[4096];
+        snprintf(dir, sizeof(dir), "%.*s", (int)root, arg);
+        add_directory(dir, root + 1);
+    } else if(is_asm(arg)) {
+        add_source(arg, arg, NULL, 0);
+    } else if(!add_tar(arg)) {
+        fprintf(stderr, "tyvm-as: cannot read %s\n", arg);
+        exit(1);
+    }
+}
+
+/* Read a whole file into a malloc'd buffer */
+static char* slurp(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if(!f) return NULL;
+
+    char* buf = NULL;
+    FILE* out = open_memstream(&buf, len);
+    char chunk[65536];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f)) > 0) fwrite(chunk, 1, n, out);
+    fclose(out);
+    fclose(f);
+    return buf;
+}
+
+static uint64_t source_hash(const char* p, size_t n) {
+    uint64_t h = (0xCBF29CE484222325u ^ LC3AS_VERSION) * 0x100000001B3u;
+    for(size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)p[i]) * 0x100000001B3u;
+    return h;
+}
+
+static void cache_path(char* path, size_t size, uint64_t hash) {
+    snprintf(path, size, "%s/%016lx.tyc", cache_dir, (unsigned long)hash);
+}
+
+/* Publish a cache entry atomically, so a concurrent reader never sees half
+of it and never a result paired with another source */
+static int cache_put(uint64_t hash, uint32_t status, const char* src, size_t len, const void* data, size_t data_len) {
+    char path[4096], tmp[4096];
+    cache_path(path, sizeof(path), hash);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+    const struct cache_entry e = { .status = status, .source_len = len, .result_len = data_len };
+    FILE* f = fopen(tmp, "wb");
+    if(!f) return FALSE;
+    int ok = fwrite(&e, sizeof(e), 1, f) == 1 && fwrite(src, 1, len, f) == len && fwrite(data, 1, data_len, f) == data_len;
+    ok = fclose(f) == 0 && ok;
+    if(!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* The entry of hash as a malloc'd buffer, if its source matches byte for
+byte; *data points at the result inside it */
+static char* cache_lookup(uint64_t hash, const char* src, size_t len, struct job* job, const char** data, size_t* data_len) {
+    char path[4096];
+    cache_path(path, sizeof(path), hash);
+
+    size_t size;
+    char* entry = slurp(path, &size);
+    const struct cache_entry* e = (const struct cache_entry*)entry;
+    if(!entry || size < sizeof(*e) || e->source_len != len || e->result_len != size - sizeof(*e) - len
+       || e->status > TYA_ERROR || memcmp(e + 1, src, len) != 0) {
+        free(entry);
+        return NULL;
+    }
+
+    job->status = e->status;
+    *data = (const char*)(e + 1) + len;
+    *data_len = e->result_len;
+    return entry;
+}
+
+/* Hand a job's image or error text to the parent */
+static int spool_result(struct job* job, const void* data, size_t len) {
+    job->spool  = spool_index;
+    job->offset = ftell(spool);
+    job->length = len;
+    return fwrite(data, 1, len, spool) == len;
+}
+
+static int assemble_source(struct source* s, struct job* job) {
+    size_t len = s->len;
+    char* owned = s->path ? slurp(s->path, &len) : NULL;
+    const char* src = s->path ? owned : s->data;
+    if(!src) {
+        snprintf(result.error, sizeof(result.error), "cannot read %s", s->path);
+        job->hash   = source_hash(result.error, strlen(result.error));
+        job->status = TYA_ERROR;
+        return spool_result(job, result.error, strlen(result.error));
+    }
+
+    job->hash = source_hash(src, len);
+
+    const char* data;
+    size_t data_len;
+    char* entry = cache_lookup(job->hash, src, len, job, &data, &data_len);
+    job->cached = entry != NULL;
+
+    int ok;
+    if(entry) {
+        ok = spool_result(job, data, data_len);
+        free(entry);
+    } else if(lc3as_assemble(src, len, &result)) {
+        char* image = NULL;
+        size_t image_len = 0;
+        FILE* f = open_memstream(&image, &image_len);
+        lc3as_write_image(&result, f);
+        fclose(f);
+
+        job->status = TYA_OK;
+        ok = spool_result(job, image, image_len) && cache_put(job->hash, TYA_OK, src, len, image, image_len);
+        free(image);
+    } else {
+        job->status = TYA_ERROR;
+        ok = spool_result(job, result.error, strlen(result.error))
+             && cache_put(job->hash, TYA_ERROR, src, len, result.error, strlen(result.error));
+    }
+
+    free(owned);
+    return ok;
+}
+
+/* What a job produced, as a malloc'd buffer of job->length bytes */
+static char* job_result(const struct job* job) {
+    char* data = malloc(job->length + 1);
+    if(!data) return NULL;
+    const int fd = fileno(spools[job->spool]);
+    for(size_t done = 0; done < job->length; ) {
+        const ssize_t n = pread(fd, data + done, job->length - done, job->offset + done);
+        if(n <= 0) {
+            free(data);
+            return NULL;
+        }
+        done += n;
+    }
+    data[job->length] = '\0';
+    return data;
+}
+
+static void mkdirs(const char* dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s", dir);
+    for(char* p = path + 1; *p; ++p) {
+        if(*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+    mkdir(path, 0755);
+}
+
+static int by_name(const void* a, const void* b) {
+    return strcmp(sources[*(const int*)a].name, sources[*(const int*)b].name);
+}
+
+/* Gather the results of the jobs into one archive, written beside it and renamed in */
+static int write_archive(const char* out, struct job* jobs) {
+    int* order = malloc(source_count * sizeof(int));
+    for(int i = 0; i < source_count; ++i) order[i] = i;
+    qsort(order, source_count, sizeof(int), by_name);
+
+    for(int i = 1; i < source_count; ++i) {
+        if(strcmp(sources[order[i]].name, sources[order[i - 1]].name) == 0) {
+            fprintf(stderr, "tyvm-as: %s given twice\n", sources[order[i]].name);
+            return FALSE;
+        }
+    }
+
+    struct tya_entry* index = calloc(source_count, sizeof(*index));
+    struct tya_header header = {
+        .magic   = TYA_MAGIC,
+        .version = TYA_VERSION,
+        .count   = source_count,
+        .names_offset = sizeof(header) + source_count * sizeof(*index)
+    };
+
+    uint64_t names_len = 0;
+    for(int i = 0; i < source_count; ++i) {
+        index[i].name = names_len;
+        names_len += strlen(sources[order[i]].name) + 1;
+    }
+    header.data_offset = header.names_offset + names_len;
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.%d", out, (int)getpid());
+    FILE* f = fopen(tmp, "wb");
+    if(!f) return FALSE;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(index, sizeof(*index), source_count, f);
+    for(int i = 0; i < source_count; ++i) fwrite(sources[order[i]].name, 1, strlen(sources[order[i]].name) + 1, f);
+
+    uint64_t offset = header.data_offset;
+    for(int i = 0; i < source_count; ++i) {
+        const struct job* job = &jobs[order[i]];
+        char* data = job_result(job);
+        if(!data) {
+            fprintf(stderr, "tyvm-as: lost the result of %s\n", sources[order[i]].name);
+            fclose(f);
+            unlink(tmp);
+            return FALSE;
+        }
+        fwrite(data, 1, job->length, f);
+        free(data);
+
+        index[i].source_hash = job->hash;
+        index[i].offset      = offset;
+        index[i].length      = job->length;
+        index[i].status      = job->status;
+        offset += job->length;
+    }
+
+    fseek(f, sizeof(header), SEEK_SET);
+    fwrite(index, sizeof(*index), source_count, f);
+    int ok = fclose(f) == 0 && rename(tmp, out) == 0;
+
+    free(index);
+    free(order);
+    return ok;
+}
+
+static int take(struct queue* q) {
+    const unsigned i = atomic_fetch_add(&q->next, 1);
+    return i < q->end ? (int)i : -1;
+}
+
+static int batch(const char* out, int workers) {
+    const size_t jobs_size = (source_count * sizeof(struct job) + 63) / 64 * 64;
+    struct job* jobs = mmap(NULL, jobs_size + topo.nodes * sizeof(struct queue),
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(jobs == MAP_FAILED) return 1;
+    struct queue* queues = (struct queue*)((char*)jobs + jobs_size);
+
+    /* each node's share of the sources is proportional to its workers */
+    if(workers > source_count) workers = source_count;
+    unsigned start = 0;
+    int placed = 0;
+    for(int n = 0; n < topo.nodes; ++n) {
+        placed += workers / topo.nodes + (n < workers % topo.nodes);
+        atomic_init(&queues[n].next, start);
+        queues[n].end = (unsigned)((uint64_t)source_count * placed / workers);
+        start = queues[n].end;
+    }
+
+    spools = calloc(workers, sizeof(*spools));
+    for(int w = 0; w < workers; ++w) {
+        if(!(spools[w] = tmpfile())) {
+            fprintf(stderr, "tyvm-as: cannot create a spool file\n");
+            return 1;
+        }
+    }
+
+    for(int w = 0; w < workers; ++w) {
+        pid_t pid = fork();
+        if(pid < 0) break;
+        if(pid > 0) continue;
+        spool = spools[w];
+        spool_index = w;
+
+        /* pinned before the first allocation, so it is node-local */
+        const int node = numa_worker_node(&topo, w);
+        if(topo.nodes > 1) numa_pin(numa_worker_cpu(&topo, w));
+
+        int victims[NUMA_MAX_NODES];
+        const int victim_count = numa_victims(&topo, node, victims);
+
+        int ok = TRUE;
+        for(int i; (i = take(&queues[node])) >= 0; ) ok = assemble_source(&sources[i], &jobs[i]) && ok;
+        for(int v = 0; v < victim_count; ++v)
+            for(int i; (i = take(&queues[victims[v]])) >= 0; ) ok = assemble_source(&sources[i], &jobs[i]) && ok;
+        _exit(ok && fflush(spool) == 0 ? 0 : 1);
+    }
+
+    int failed = FALSE, status;
+    while(wait(&status) > 0) failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    for(int n = 0; n < topo.nodes; ++n) failed |= atomic_load(&queues[n].next) < queues[n].end;
+    if(failed) {
+        fprintf(stderr, "tyvm-as: could not write the cache in %s\n", cache_dir);
+        return 1;
+    }
+
+    int cached = 0, errors = 0;
+    for(int i = 0; i < source_count; ++i) {
+        cached += jobs[i].cached;
+        if(jobs[i].status != TYA_ERROR) continue;
+
+        errors++;
+        char* msg = job_result(&jobs[i]);
+        fprintf(stderr, "%s: %s\n", sources[i].name, msg ? msg : "");
+        free(msg);
+    }
+
+    if(!write_archive(out, jobs)) {
+        fprintf(stderr, "tyvm-as: cannot write %s\n", out);
+        return 1;
+    }
+
+    printf("%d sources: %d cached, %d assembled, %d failed\n", source_count, cached, source_count - cached, errors);
+    return 0;
+}
+
+static int single(const char* in, const char* out) {
+    size_t len;
+    char* src = slurp(in, &len);
+    if(!src) {
+        fprintf(stderr, "tyvm-as: cannot read %s\n", in);
+        return 1;
+    }
+
+    if(!lc3as_assemble(src, len, &result)) {
+        fprintf(stderr, "%s: %s\n", in, result.error);
+        return 1;
+    }
+
+    char obj[4096];
+    if(!out) {
+        snprintf(obj, sizeof(obj), "%.*s.obj", (int)(strlen(in) - 4), in);
+        out = obj;
+    }
+
+    FILE* f = fopen(out, "wb");
+    if(!f || !lc3as_write_image(&result, f) || fclose(f) != 0) {
+        fprintf(stderr, "tyvm-as: cannot write %s\n", out);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* out = NULL;
+    int workers = numa_topology(&topo) ? topo.cpus : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    char default_cache[4096];
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) out = argv[++i];
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) workers = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) cache_dir = argv[++i];
+        else add_input(argv[i]);
+    }
+
+    const size_t out_len = out ? strlen(out) : 0;
+    const int archive = out_len > 4 && strcmp(out + out_len - 4, ".tya") == 0;
+
+    if(!archive) {
+        if(source_count != 1 || !sources[0].path) {
+            printf("usage: %s prog.asm [-o prog.obj]\n", argv[0]);
+            printf("       %s [-j jobs] [-c cache] -o batch.tya source...\n", argv[0]);
+            exit(2);
+        }
+        return single(sources[0].path, out);
+    }
+
+    if(source_count == 0) {
+        fprintf(stderr, "tyvm-as: no .asm sources\n");
+        exit(2);
+    }
+
+    if(!cache_dir) cache_dir = getenv("TYVM_CACHE");
+    if(!cache_dir || !*cache_dir) {
+        const char* home = getenv("HOME");
+        snprintf(default_cache, sizeof(default_cache), "%s/.cache/tyvm", home && *home ? home : "/tmp");
+        cache_dir = default_cache;
+    }
+    mkdirs(cache_dir);
+
+    return batch(out, workers > 0 ? workers : 1);
+}
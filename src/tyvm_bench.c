@@ -0,0 +1,130 @@
+/*
+    tyvm-bench: measure how long tyvm takes to start and to finish short jobs.
+    Copyright (c) 2022 Erick Ahmed
+    Open-source software distributed under GNU GPL v.3 license
+
+    Usage:
+        tyvm-bench [-n runs] [-i input] [-b vm] image
+
+    Runs the VM (-b, default tyvm-unix next to this binary) -n times on
+    the image with stdout discarded, and reports the time from execve to
+    the first guest instruction, to the end of the guest program, and to
+    the exit of the process. The child takes the execve stamp right before
+    exec'ing; the VM writes the other two to TYVM_BENCH_FD (see stats.h).
+*/
+
+#include "preprocessor.h"
+#include "stats.h"
+
+#include <limits.h>
+#include <sys/wait.h>
+
+enum bench_phase {
+    BP_FIRST = 0,       // execve to the first guest instruction
+    BP_END,             // execve to HALT
+    BP_EXIT,            // execve to the process being reaped
+    BP_COUNT
+};
+
+static const char* phase_names[BP_COUNT] = { "first instruction", "halt", "exit" };
+
+static int by_value(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* One run, 0 on success with the three latencies in ns */
+static int run_once(const char* vm, const char* image, const char* input, volatile uint64_t* exec_ns, uint64_t out[BP_COUNT]) {
+    int fds[2];
+    if(pipe(fds) != 0) return -1;
+
+    pid_t pid = fork();
+    if(pid < 0) return -1;
+    if(pid == 0) {
+        close(fds[0]);
+        int in   = open(input ? input : "/dev/null", O_RDONLY);
+        int null = open("/dev/null", O_WRONLY);
+        if(in < 0 || null < 0) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+
+        char fd[16];
+        snprintf(fd, sizeof(fd), "%d", fds[1]);
+        setenv("TYVM_BENCH_FD", fd, 1);
+
+        *exec_ns = stats_now_ns();
+        execl(vm, vm, image, (char*)NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    /* the two marks arrive as separate writes */
+    uint64_t marks[2];
+    size_t n = 0;
+    for(ssize_t got; n < sizeof(marks) && (got = read(fds[0], (char*)marks + n, sizeof(marks) - n)) > 0; ) n += got;
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    const uint64_t reaped = stats_now_ns();
+
+    if(n != sizeof(marks) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    out[BP_FIRST] = marks[0] - *exec_ns;
+    out[BP_END]   = marks[1] - *exec_ns;
+    out[BP_EXIT]  = reaped - *exec_ns;
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    int runs = 1000;
+    const char* input = NULL;
+    const char* vm = NULL;
+    const char* image = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) input = argv[++i];
+        else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) vm = argv[++i];
+        else image = argv[i];
+    }
+
+    if(!image || runs < 1) {
+        printf("usage: %s [-n runs] [-i input] [-b vm] image\n", argv[0]);
+        exit(2);
+    }
+
+    char default_vm[PATH_MAX];
+    if(!vm) {
+        ssize_t len = readlink("/proc/self/exe", default_vm, sizeof(default_vm) - 1);
+        default_vm[len > 0 ? len : 0] = '\0';
+        char* slash = strrchr(default_vm, '/');
+        snprintf(slash ? slash + 1 : default_vm, sizeof(default_vm) - (slash ? slash + 1 - default_vm : 0), "tyvm-unix");
+        vm = default_vm;
+    }
+
+    /* the child's execve stamp survives the exec in a shared page */
+    volatile uint64_t* exec_ns = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    uint64_t* samples[BP_COUNT];
+    for(int p = 0; p < BP_COUNT; ++p) samples[p] = malloc(runs * sizeof(uint64_t));
+    if(exec_ns == MAP_FAILED) return 1;
+
+    for(int r = 0; r < runs; ++r) {
+        uint64_t t[BP_COUNT];
+        if(run_once(vm, image, input, exec_ns, t) != 0) {
+            fprintf(stderr, "tyvm-bench: run %d of %s failed\n", r, vm);
+            return 1;
+        }
+        for(int p = 0; p < BP_COUNT; ++p) samples[p][r] = t[p];
+    }
+
+    printf("%s %s, %d runs (us)\n", vm, image, runs);
+    printf("%-18s %9s %9s %9s %9s\n", "", "min", "median", "p99", "mean");
+    for(int p = 0; p < BP_COUNT; ++p) {
+        qsort(samples[p], runs, sizeof(uint64_t), by_value);
+        double sum = 0;
+        for(int r = 0; r < runs; ++r) sum += samples[p][r];
+        printf("%-18s %9.1f %9.1f %9.1f %9.1f\n", phase_names[p], samples[p][0] / 1e3, samples[p][runs / 2] / 1e3,
+               samples[p][(int)((runs - 1) * 0.99)] / 1e3, sum / runs / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+/*
+    tyvm-bisect: find the first instruction where two runs diverge.
+    Copyright (c) 2022 Erick Ahmed
+    Open-source software distributed under GNU GPL v.3 license
+
+    Usage:
+        tyvm-bisect [-k interval] [-n limit] imageA[:input] [imageB][:input]
+
+    Compares two images, or one image on two inputs ("prog.obj:in1
+    :in2"). Both runs advance in lockstep chunks of -k instructions and
+    only a hash of registers, memory and console output is compared at
+    the end of each chunk (registers and output only when the two images
+    differ to begin with). The first chunk that disagrees is bisected from
+    its starting checkpoint down to the single instruction that makes the
+    states differ, and both states are printed there.
+
+    A divergence that heals itself within one chunk is not seen; lower -k
+    to catch those.
+*/
+
+#include "preprocessor.h"
+#include "registers.h"
+#include "lc3_lib.h"
+#include "vm.h"
+
+/* One of the two runs */
+struct side {
+    const char* image;
+    const char* input;
+    FILE* in;
+    FILE* out;
+    char* out_buf;
+    size_t out_len;
+
+    struct vm_state check;          // last checkpoint both sides agreed on
+    long check_in;                  // input and output positions at that checkpoint
+    long check_out;
+    uint64_t check_out_hash;        // hash of the output up to check_out
+    enum vm_exit check_status;      // a run that ended stays ended
+
+    struct vm_state next;           // end of the chunk being compared
+    long next_in;
+    long next_out;
+    uint64_t next_out_hash;
+
+    enum vm_exit status;            // how the last run ended
+};
+
+static struct side sides[2];
+static struct vm_state scratch;
+static int compare_memory = TRUE;       // off when the images themselves differ
+
+/* Split "image:input" */
+static void parse_side(struct side* s, const char* arg, const char* fallback_image) {
+    char* copy = strdup(arg);
+    char* colon = strrchr(copy, ':');
+    if(colon) {
+        *colon = '\0';
+        s->input = colon + 1;
+    }
+    s->image = *copy ? copy : fallback_image;
+}
+
+static void start_side(struct side* s) {
+    memset(memory, 0, sizeof(memory));
+    if(!read_image(s->image)) {
+        printf("failed to load image: %s\n", s->image);
+        exit(1);
+    }
+    vm_reset(PC_START);
+    vm_save(&s->check);
+
+    s->in  = s->input && *s->input ? fopen(s->input, "rb") : tmpfile();
+    s->out = open_memstream(&s->out_buf, &s->out_len);
+    if(!s->in || !s->out) {
+        printf("failed to open input: %s\n", s->input);
+        exit(1);
+    }
+    s->check_in       = 0;
+    s->check_out      = 0;
+    s->check_out_hash = 0xCBF29CE484222325u;
+    s->check_status   = VM_LIMIT;
+}
+
+/* Restore a side to its checkpoint and run it for n instructions */
+static void run_from_check(struct side* s, uint64_t n) {
+    vm_load(&s->check);
+    fseek(s->in, s->check_in, SEEK_SET);
+    fseek(s->out, s->check_out, SEEK_SET);
+    vm_in  = s->in;
+    vm_out = s->out;
+    s->status = s->check_status != VM_LIMIT || n == 0 ? s->check_status : vm_run(n);
+    fflush(s->out);
+}
+
+/* Hash of the output written since the checkpoint, chained on the checkpoint's */
+static uint64_t output_hash(struct side* s) {
+    uint64_t h = s->check_out_hash;
+    const long len = ftell(s->out);
+    for(long i = s->check_out; i < len; ++i) h = (h ^ (uint8_t)s->out_buf[i]) * 0x100000001B3u;
+    return h;
+}
+
+/* Hash of the state the VM currently holds, plus the side's console output */
+static uint64_t side_hash(struct side* s) {
+    uint64_t h = output_hash(s);
+    if(compare_memory) h ^= vm_hash();
+    else for(int r = 0; r < RG_COUNT; ++r) h = (h ^ reg[r]) * 0x100000001B3u;
+    h = (h ^ (uint64_t)ftell(s->out)) * 0x100000001B3u;
+    h = (h ^ (uint64_t)(s->status == VM_LIMIT)) * 0x100000001B3u;
+    return (h ^ vm_retired) * 0x100000001B3u;
+}
+
+/* Run a side n instructions past its checkpoint and hash it */
+static uint64_t probe(struct side* s, uint64_t n) {
+    run_from_check(s, n);
+    return side_hash(s);
+}
+
+static const char* op_names[16] = {
+    "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+};
+
+static void print_state(const char* name, struct side* s) {
+    printf("%s: %s%s%s\n", name, s->image, s->input ? " < " : "", s->input ? s->input : "");
+    printf("  retired %lu  output %ld bytes  %s\n", (unsigned long)vm_retired, ftell(s->out),
+           s->status == VM_HALT ? "halted" : s->status == VM_ILLEGAL ? "illegal instruction" : "running");
+    printf("  PC x%04X  next x%04X (%s)  COND %c\n", reg[RG_PC], memory[reg[RG_PC]], op_names[memory[reg[RG_PC]] >> 12],
+           reg[RG_COND] == FL_N ? 'N' : reg[RG_COND] == FL_Z ? 'Z' : 'P');
+    printf("  R0 x%04X  R1 x%04X  R2 x%04X  R3 x%04X\n", reg[0], reg[1], reg[2], reg[3]);
+    printf("  R4 x%04X  R5 x%04X  R6 x%04X  R7 x%04X\n", reg[4], reg[5], reg[6], reg[7]);
+}
+
+/* Bisect [lo, hi] instructions past the checkpoints: equal at lo, different at hi */
+static void report(uint64_t lo, uint64_t hi) {
+    while(hi - lo > 1) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if(probe(&sides[0], mid) == probe(&sides[1], mid)) lo = mid;
+        else hi = mid;
+    }
+
+    /* the instruction each side executes next is the one that splits them */
+    run_from_check(&sides[0], lo);
+    const uint16_t pc_a = reg[RG_PC], instr_a = memory[reg[RG_PC]];
+    run_from_check(&sides[1], lo);
+    const uint16_t pc_b = reg[RG_PC], instr_b = memory[reg[RG_PC]];
+
+    printf("runs diverge at instruction %lu: A x%04X (x%04X)  B x%04X (x%04X)\n\n",
+           (unsigned long)(sides[0].check.retired + hi), pc_a, instr_a, pc_b, instr_b);
+
+    run_from_check(&sides[0], hi);
+    vm_save(&scratch);
+    print_state("A", &sides[0]);
+    run_from_check(&sides[1], hi);
+    print_state("B", &sides[1]);
+
+    int shown = 0;
+    for(uint32_t a = 0; a <= UINT16_MAX; ++a) {
+        if(scratch.memory[a] == memory[a]) continue;
+        if(shown++ == 0) printf("memory A/B\n");
+        if(shown <= 16) printf("  x%04X  x%04X x%04X\n", a, scratch.memory[a], memory[a]);
+    }
+    if(shown > 16) printf("  ... %d words differ\n", shown);
+}
+
+int main(int argc, const char* argv[]) {
+    uint64_t interval = 1 << 20;
+    uint64_t limit = UINT64_MAX;
+    const char* args[2];
+    int arg_count = 0;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-k") == 0 && i + 1 < argc) interval = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) limit = strtoull(argv[++i], NULL, 0);
+        else if(arg_count < 2) args[arg_count++] = argv[i];
+    }
+
+    if(arg_count != 2 || interval == 0) {
+        printf("usage: %s [-k interval] [-n limit] imageA[:input] [imageB][:input]\n", argv[0]);
+        exit(2);
+    }
+
+    parse_side(&sides[0], args[0], NULL);
+    parse_side(&sides[1], args[1], sides[0].image);
+    start_side(&sides[0]);
+    start_side(&sides[1]);
+
+    if(memcmp(sides[0].check.memory, sides[1].check.memory, sizeof(memory)) != 0) {
+        printf("images differ, comparing registers and output only\n");
+        compare_memory = FALSE;
+    }
+
+    for(uint64_t done = 0; done < limit; done += interval) {
+        const uint64_t n = limit - done < interval ? limit - done : interval;
+
+        uint64_t hash[2];
+        for(int i = 0; i < 2; ++i) {
+            struct side* s = &sides[i];
+            hash[i] = probe(s, n);
+            vm_save(&s->next);
+            s->next_in       = ftell(s->in);
+            s->next_out      = ftell(s->out);
+            s->next_out_hash = output_hash(s);
+        }
+
+        if(hash[0] != hash[1]) {
+            report(0, n);
+            return 1;
+        }
+
+        if(sides[0].status != VM_LIMIT && sides[1].status != VM_LIMIT) {
+            printf("no divergence, both runs ended after %lu instructions\n", (unsigned long)vm_retired);
+            return 0;
+        }
+
+        /* both agree: this chunk's end is the next checkpoint */
+        for(int i = 0; i < 2; ++i) {
+            struct side* s = &sides[i];
+            memcpy(&s->check, &s->next, sizeof(s->check));
+            s->check_in       = s->next_in;
+            s->check_out      = s->next_out;
+            s->check_out_hash = s->next_out_hash;
+            s->check_status   = s->status;
+        }
+    }
+
+    printf("no divergence within %lu instructions\n", (unsigned long)limit);
+    return 0;
+}
@@ -0,0 +1,690 @@
+/*
+    tyvm-opt: offline image-to-image optimizer for LC-3 programs.
+    Copyright (c) 2022 Erick Ahmed
+    Open-source software distributed under GNU GPL v.3 license
+
+    Usage:
+        tyvm-opt [-a] [-p profile] [-i input]... [-n limit] [-v] in.obj out.obj
+
+    The image is decoded by following control flow from x3000, split into
+    basic blocks, and rewritten without moving any block start:
+      - "BRcc A; BR LOOP; A:" at the bottom of a loop becomes
+        "BR!cc LOOP; BR A", so the hot loop path runs one instruction less,
+      - branches to branches are threaded to their final target,
+      - instructions whose result is already there or never read
+        (AND Rx,Rx,#0 twice, ADD Rx,Rx,#0 before a flag update, ...) are
+        removed and the rest of the block is packed towards its start.
+
+    Original and optimized image are then run side by side on every -i
+    input (no input by default) for at most -n instructions; output is
+    written only if both halt with the same console output, R0-R6 and data
+    memory. Computed jumps (JMP Rn, JSRR) can land anywhere, so blocks are
+    only packed when there are none, or with -a to assume they only reach
+    addresses the program takes with LEA or stores in a .FILL.
+
+    A value profile (-p, from tools/valprof.so) supplies the targets its
+    computed jumps actually took: they are decoded and optimized like any
+    other block start, and a jump whose every observed target was recorded
+    no longer prevents packing. Its constant loads, those that only read
+    image words the program never wrote, make the loaded value known to
+    the removal pass as if it were an immediate. Only the optimizer trusts
+    the profile; the side-by-side runs still decide whether the result is
+    written.
+*/
+
+#include "preprocessor.h"
+#include "registers.h"
+#include "lc3_lib.h"
+#include "vm.h"
+
+#define MAX_INPUTS 64
+
+/* What CFG recovery learned about each address */
+enum addr_flags {
+    AF_CODE   = 1 << 0,     // decoded as an instruction
+    AF_LEADER = 1 << 1,     // starts a basic block
+    AF_TARGET = 1 << 2,     // reached by a jump, not only by falling through
+    AF_DATA   = 1 << 3,     // read or written as data by LD/LDI/ST/STI
+    AF_TAKEN  = 1 << 4,     // address taken by LEA or a .FILL, possible computed jump target
+    AF_DEAD   = 1 << 5      // instruction removed by the optimizer
+};
+
+#define COND_BIT  (1 << 8)              // liveness bit of the condition flags
+#define ALL_LIVE  0x1FF
+
+#define NOP       0x0000                // BR with no condition
+
+static uint16_t original[UINT16_MAX + 1];
+static uint16_t image[UINT16_MAX + 1];
+static uint8_t  flags[UINT16_MAX + 1];
+static uint16_t origin;
+static uint32_t length;
+static int computed_jumps;
+
+/* from the value profile: observed computed jump targets, and the jump
+sites whose targets were all recorded */
+static uint16_t profile_targets[UINT16_MAX + 1];
+static int profile_target_count;
+static uint8_t profiled_site[UINT16_MAX + 1];
+
+/* ... and the loads that always returned val, reading only [lo, hi] */
+struct const_load {
+    uint16_t val;
+    uint16_t lo;
+    uint16_t hi;
+    uint8_t valid;
+};
+static struct const_load profile_loads[UINT16_MAX + 1];
+
+static int verbose;
+static unsigned n_threaded, n_inverted, n_removed, n_packed;
+
+/* ---------- decoding helpers ---------- */
+
+static uint16_t opc(uint16_t i)  { return i >> 12; }
+static uint16_t dr_of(uint16_t i) { return (i >> 9) & 0x7; }
+static uint16_t sr1_of(uint16_t i) { return (i >> 6) & 0x7; }
+static int in_image(uint32_t a) { return a >= origin && a < origin + length; }
+
+/* Absolute target of a PC-relative instruction at pc */
+static uint16_t rel_target(uint16_t pc, uint16_t i) {
+    if(opc(i) == OP_JSR) return pc + 1 + sign_extend(i & 0x7FF, 11);
+    return pc + 1 + sign_extend(i & 0x1FF, 9);
+}
+
+static int is_pc_relative(uint16_t i) {
+    switch(opc(i)) {
+        case OP_BR:  return (i & 0x0E00) != 0;
+        case OP_JSR: return (i >> 11) & 1;
+        case OP_LD: case OP_LDI: case OP_ST: case OP_STI: case OP_LEA: return TRUE;
+        default:     return FALSE;
+    }
+}
+
+/* Re-encode a PC-relative instruction moved to pc, keeping its target. 0 if out of range */
+static int retarget(uint16_t pc, uint16_t* i, uint16_t target) {
+    const int bits = opc(*i) == OP_JSR ? 11 : 9;
+    const int off  = (int16_t)(uint16_t)(target - pc - 1);
+    if(off < -(1 << (bits - 1)) || off >= (1 << (bits - 1))) return FALSE;
+
+    const uint16_t mask = (1 << bits) - 1;
+    *i = (*i & ~mask) | (off & mask);
+    return TRUE;
+}
+
+/* Does execution continue at the next address after i? */
+static int falls_through(uint16_t i) {
+    switch(opc(i)) {
+        case OP_BR:   return ((i >> 9) & 0x7) != 0x7;
+        case OP_JMP:  return FALSE;
+        case OP_TRAP: return (i & 0xFF) != TC_HALT;
+        case OP_RTI:
+        case OP_RES:  return FALSE;
+        default:      return TRUE;
+    }
+}
+
+/* Does i end a basic block? BR with no condition is a plain NOP */
+static int ends_block(uint16_t i) {
+    switch(opc(i)) {
+        case OP_BR:   return (i & 0x0E00) != 0;
+        case OP_JMP: case OP_JSR: case OP_TRAP: case OP_RTI: case OP_RES: return TRUE;
+        default:      return FALSE;
+    }
+}
+
+/* Registers (bits 0-7) and COND (bit 8) written by i */
+static unsigned defs(uint16_t i) {
+    switch(opc(i)) {
+        case OP_ADD: case OP_AND: case OP_NOT:
+        case OP_LD: case OP_LDR: case OP_LDI: case OP_LEA:
+            return (1 << dr_of(i)) | COND_BIT;
+        case OP_JSR:  return 1 << RG_R7;
+        case OP_TRAP: return (1 << RG_R0) | (1 << RG_R7) | COND_BIT;
+        default:      return 0;
+    }
+}
+
+/* Registers and COND read by i */
+static unsigned uses(uint16_t i) {
+    switch(opc(i)) {
+        case OP_ADD: case OP_AND:
+            return (1 << sr1_of(i)) | (((i >> 5) & 1) ? 0 : 1 << (i & 0x7));
+        case OP_NOT:  return 1 << sr1_of(i);
+        case OP_LDR:  return 1 << sr1_of(i);
+        case OP_ST: case OP_STI: return 1 << dr_of(i);
+        case OP_STR:  return (1 << dr_of(i)) | (1 << sr1_of(i));
+        case OP_BR:   return (i & 0x0E00) ? COND_BIT : 0;
+        case OP_JMP:  return 1 << sr1_of(i);
+        case OP_JSR:  return ((i >> 11) & 1) ? 0 : 1 << sr1_of(i);
+        case OP_TRAP: return ALL_LIVE;
+        default:      return 0;
+    }
+}
+
+/* Can i go away when nothing reads what it writes? */
+static int removable(uint16_t pc, uint16_t i) {
+    switch(opc(i)) {
+        case OP_ADD: case OP_AND: case OP_NOT: case OP_LEA: return TRUE;
+        case OP_BR:  return (i & 0x0E00) == 0;
+        case OP_LD: {
+            const uint16_t a = rel_target(pc, i);
+            return a != MR_KSR && a != MR_KDR;      // device reads have side effects
+        }
+        default:     return FALSE;
+    }
+}
+
+static uint16_t flags_of(uint16_t v) {
+    if(v == 0) return FL_Z;
+    return (v >> 15) ? FL_N : FL_P;
+}
+
+/* ---------- CFG recovery ---------- */
+
+static void mark_leader(uint32_t a, int target) {
+    if(!in_image(a)) return;
+    flags[a] |= AF_LEADER;
+    if(target) flags[a] |= AF_TARGET;
+}
+
+/* Worklist of addresses to trace; each goes in at most once, so the
+stack holds at most one entry per word however many branches and
+profile lines name it */
+static uint16_t work[UINT16_MAX + 1];
+static uint8_t queued[UINT16_MAX + 1];
+static int work_top;
+
+static void push_work(uint16_t a) {
+    if(!in_image(a) || queued[a]) return;
+    queued[a] = TRUE;
+    work[work_top++] = a;
+}
+
+static void recover_cfg(uint16_t entry) {
+    mark_leader(entry, TRUE);
+    push_work(entry);
+
+    for(int t = 0; t < profile_target_count; ++t) {
+        if(!in_image(profile_targets[t])) continue;
+        mark_leader(profile_targets[t], TRUE);
+        push_work(profile_targets[t]);
+    }
+
+    while(work_top > 0) {
+        uint16_t pc = work[--work_top];
+
+        while(in_image(pc) && !(flags[pc] & AF_CODE)) {
+            const uint16_t i = image[pc];
+            flags[pc] |= AF_CODE;
+
+            switch(opc(i)) {
+                case OP_BR:
+                    if(i & 0x0E00) {
+                        mark_leader(rel_target(pc, i), TRUE);
+                        push_work(rel_target(pc, i));
+                        mark_leader(pc + 1, FALSE);
+                    }
+                    break;
+                case OP_JSR:
+                    if((i >> 11) & 1) {
+                        mark_leader(rel_target(pc, i), TRUE);
+                        push_work(rel_target(pc, i));
+                    } else if(!profiled_site[pc]) computed_jumps = TRUE;
+                    mark_leader(pc + 1, TRUE);          // return address
+                    break;
+                case OP_JMP:
+                    if(sr1_of(i) != RG_R7 && !profiled_site[pc]) computed_jumps = TRUE;
+                    break;
+                case OP_TRAP:
+                    mark_leader(pc + 1, FALSE);
+                    break;
+                case OP_LD: case OP_LDI: case OP_ST: case OP_STI:
+                    if(in_image(rel_target(pc, i))) flags[rel_target(pc, i)] |= AF_DATA;
+                    break;
+                case OP_LEA:
+                    if(in_image(rel_target(pc, i))) flags[rel_target(pc, i)] |= AF_TAKEN;
+                    break;
+            }
+
+            if(!falls_through(i)) break;
+            ++pc;
+        }
+    }
+
+    /* any word that holds an address of the image may be a pointer to code */
+    for(uint32_t a = origin; a < origin + length; ++a)
+        if(!(flags[a] & AF_CODE) && in_image(image[a])) flags[image[a]] |= AF_TAKEN;
+
+    for(uint32_t a = origin; a < origin + length; ++a)
+        if((flags[a] & AF_CODE) && (flags[a] & AF_TAKEN)) flags[a] |= AF_LEADER | AF_TARGET;
+}
+
+/* ---------- in-place rewrites ---------- */
+
+/* Follow branches to branches from a BRcc or JSR at pc */
+static void thread_jump(uint16_t pc) {
+    uint16_t i = image[pc];
+    const uint16_t cond = opc(i) == OP_BR ? (i >> 9) & 0x7 : 0x7;     // JSR always jumps
+    uint16_t target = rel_target(pc, i);
+    uint16_t best = target;
+
+    for(int hop = 0; hop < 16; ++hop) {
+        if(!in_image(target) || !(flags[target] & AF_CODE) || (flags[target] & AF_DATA)) break;
+        const uint16_t t = image[target];
+        if(opc(t) != OP_BR || !(t & 0x0E00)) break;
+
+        const uint16_t tcond = (t >> 9) & 0x7;
+        uint16_t next;
+        if((cond & tcond) == cond) next = rel_target(target, t);    // taken whenever we got here
+        else if((cond & tcond) == 0) next = target + 1;              // never taken from here
+        else break;
+
+        if(next == target) break;
+        target = next;
+
+        uint16_t probe = i;
+        if(retarget(pc, &probe, target)) best = target;
+    }
+
+    if(best != rel_target(pc, i) && retarget(pc, &i, best)) {
+        if(verbose) fprintf(stderr, "thread   x%04X -> x%04X\n", pc, best);
+        image[pc] = i;
+        flags[best] |= AF_LEADER | AF_TARGET;
+        n_threaded++;
+    }
+}
+
+/* BRcc A; BRnzp LOOP; A:  with LOOP behind us  ->  BR!cc LOOP; BRnzp A; A:
+The second jump costs what the NOP would, and threading can still move it */
+static void invert_loop_exit(uint16_t pc) {
+    const uint16_t i = image[pc];
+    const uint16_t cond = (i >> 9) & 0x7;
+    if(opc(i) != OP_BR || cond == 0 || cond == 0x7) return;
+    if(rel_target(pc, i) != (uint16_t)(pc + 2)) return;
+
+    const uint16_t next = pc + 1;
+    if(!in_image(next) || (flags[next] & (AF_TARGET | AF_DATA)) || !(flags[next] & AF_CODE)) return;
+
+    const uint16_t j = image[next];
+    if(opc(j) != OP_BR || ((j >> 9) & 0x7) != 0x7) return;
+
+    const uint16_t loop = rel_target(next, j);
+    if(loop > pc) return;               // not a back edge
+
+    uint16_t inverted = (i & 0xF1FF) | ((~cond & 0x7) << 9);
+    if(!retarget(pc, &inverted, loop)) return;
+
+    if(verbose) fprintf(stderr, "invert   x%04X\n", pc);
+    image[pc] = inverted;
+    image[next] = 0x0E00;           // BRnzp to the next address
+    n_inverted++;
+}
+
+/* ---------- per block removal and packing ---------- */
+
+/* The value the load at pc always returned, if the profile has it reading
+image words only, none of which this optimizer may rewrite */
+static int constant_load(uint16_t pc, uint16_t i, uint16_t* v) {
+    const struct const_load* l = &profile_loads[pc];
+    if(!l->valid || opc(i) != opc(original[pc]) || l->lo > l->hi || !in_image(l->lo) || !in_image(l->hi)) return FALSE;
+    for(uint32_t a = l->lo; a <= l->hi; ++a)
+        if(flags[a] & AF_CODE) return FALSE;
+    if(opc(i) == OP_LD && (rel_target(pc, i) != l->lo || original[l->lo] != l->val)) return FALSE;
+    *v = l->val;
+    return TRUE;
+}
+
+/* Mark instructions of [start, end] that can go, until nothing changes */
+static void prune_block(uint16_t start, uint16_t end) {
+    int changed = TRUE;
+    while(changed) {
+        changed = FALSE;
+
+        /* backward liveness, everything is live when the block is left */
+        static unsigned live_after[UINT16_MAX + 1];
+        unsigned live = ALL_LIVE;
+        for(int pc = end; pc >= start; --pc) {
+            if(flags[pc] & AF_DEAD) continue;
+            live_after[pc] = live;
+            live = (live & ~defs(image[pc])) | uses(image[pc]);
+        }
+
+        /* forward: values and flags already known */
+        uint16_t known = 0, val[8] = {0};
+        int cond_reg = -1;          // register the flags currently reflect
+        uint16_t cond_flag = 0;     // known flag value, 0 if unknown
+
+        for(int pc = start; pc <= end; ++pc) {
+            if(flags[pc] & AF_DEAD) continue;
+            const uint16_t i = image[pc];
+            const uint16_t d = dr_of(i), s = sr1_of(i);
+            const int imm = (i >> 5) & 1;
+            const uint16_t imm5 = sign_extend(i & 0x1F, 5);
+
+            int value_known = FALSE, same_value = FALSE;
+            uint16_t v = 0;
+
+            switch(opc(i)) {
+                case OP_ADD:
+                    if(imm && imm5 == 0 && s == d) same_value = TRUE;
+                    if(imm && (known >> s & 1)) { v = val[s] + imm5; value_known = TRUE; }
+                    if(!imm && (known >> s & 1) && (known >> (i & 7) & 1)) { v = val[s] + val[i & 7]; value_known = TRUE; }
+                    break;
+                case OP_AND:
+                    if(imm && imm5 == 0xFFFF && s == d) same_value = TRUE;
+                    if(imm && imm5 == 0) { v = 0; value_known = TRUE; }
+                    else if(imm && (known >> s & 1)) { v = val[s] & imm5; value_known = TRUE; }
+                    if(!imm && (known >> s & 1) && (known >> (i & 7) & 1)) { v = val[s] & val[i & 7]; value_known = TRUE; }
+                    break;
+                case OP_NOT:
+                    if(known >> s & 1) { v = ~val[s]; value_known = TRUE; }
+                    break;
+                case OP_LEA:
+                    v = rel_target(pc, i);
+                    value_known = TRUE;
+                    break;
+                case OP_LD: case OP_LDR: case OP_LDI:
+                    value_known = constant_load(pc, i, &v);
+                    break;
+            }
+            if(value_known && (known >> d & 1) && val[d] == v) same_value = TRUE;
+
+            int dead = FALSE;
+            if(removable(pc, i)) {
+                const unsigned wr = defs(i);
+                if((wr & live_after[pc]) == 0) dead = TRUE;
+                else if(same_value && (!(live_after[pc] & COND_BIT) || cond_reg == d
+                        || (value_known && cond_flag == flags_of(v)))) dead = TRUE;
+                else if(same_value && (known >> d & 1) && cond_flag == flags_of(val[d])) dead = TRUE;
+            }
+
+            if(dead) {
+                if(verbose) fprintf(stderr, "remove   x%04X x%04X\n", pc, i);
+                flags[pc] |= AF_DEAD;
+                changed = TRUE;
+                continue;
+            }
+
+            /* update what is known after i */
+            const unsigned wr = defs(i);
+            for(int r = 0; r < 8; ++r) {
+                if(!(wr >> r & 1)) continue;
+                known &= ~(1 << r);
+                if(cond_reg == r) cond_reg = -1;
+            }
+            if(value_known && (wr >> d & 1)) {
+                known |= 1 << d;
+                val[d] = v;
+            }
+            if(wr & COND_BIT) {
+                cond_reg  = opc(i) == OP_TRAP ? -1 : d;
+                cond_flag = value_known ? flags_of(v) : 0;
+            }
+        }
+    }
+}
+
+/* Pack the live instructions of [start, end] towards start, 0 if not worth it or impossible */
+static int pack_block(uint16_t start, uint16_t end) {
+    static uint16_t packed[UINT16_MAX + 1];
+    int kept = 0, removed = 0;
+
+    for(uint32_t pc = start; pc <= end; ++pc) {
+        if(flags[pc] & AF_DEAD) {
+            removed++;
+            continue;
+        }
+
+        uint16_t i = image[pc];
+        const uint16_t at = start + kept;
+        if(at != pc && is_pc_relative(i) && !retarget(at, &i, rel_target(pc, i))) return FALSE;
+        packed[kept++] = i;
+    }
+    if(removed == 0) return FALSE;
+
+    /* the instruction that leaves the block, if any */
+    const int through = kept == 0 || falls_through(packed[kept - 1]);
+    const int cond_br = kept > 0 && opc(packed[kept - 1]) == OP_BR && falls_through(packed[kept - 1]);
+    if(through && removed < 2 && !cond_br) return FALSE;
+
+    for(int k = 0; k < kept; ++k) image[start + k] = packed[k];
+    for(uint32_t pc = start + kept; pc <= end; ++pc) image[pc] = NOP;
+
+    /* the fall-through path now needs a jump over the freed slots */
+    if(through) {
+        uint16_t jump = 0x0E00;
+        retarget(start + kept, &jump, end + 1);
+        image[start + kept] = jump;
+    }
+
+    n_packed++;
+    n_removed += removed;
+    return TRUE;
+}
+
+static void optimize(int assume_taken) {
+    recover_cfg(PC_START);
+
+    for(uint32_t pc = origin; pc < origin + length; ++pc)
+        if((flags[pc] & AF_CODE) && !(flags[pc] & AF_DATA)) invert_loop_exit(pc);
+
+    for(uint32_t pc = origin; pc < origin + length; ++pc) {
+        if(!(flags[pc] & AF_CODE) || (flags[pc] & AF_DATA)) continue;
+        const uint16_t i = image[pc];
+        if((opc(i) == OP_BR && (i & 0x0E00)) || (opc(i) == OP_JSR && ((i >> 11) & 1))) thread_jump(pc);
+    }
+
+    if(computed_jumps && !assume_taken) {
+        if(verbose) fprintf(stderr, "computed jumps present, blocks are not packed (see -a)\n");
+        return;
+    }
+
+    for(uint32_t start = origin; start < origin + length; ++start) {
+        if(!(flags[start] & AF_CODE) || !(flags[start] & AF_LEADER)) continue;
+
+        /* the block runs until its terminator, the next leader or non-code */
+        uint32_t end = start;
+        int frozen = (flags[start] & AF_DATA) != 0;
+        while(!ends_block(image[end]) && end + 1 < origin + length
+              && (flags[end + 1] & AF_CODE) && !(flags[end + 1] & AF_LEADER)) {
+            ++end;
+            frozen |= (flags[end] & AF_DATA) != 0;
+        }
+        if(frozen) continue;
+
+        prune_block(start, end);
+        if(!pack_block(start, end))
+            for(uint32_t pc = start; pc <= end; ++pc) flags[pc] &= ~AF_DEAD;
+        start = end;
+    }
+}
+
+/* ---------- differential execution ---------- */
+
+struct run_result {
+    enum vm_exit status;
+    uint64_t retired;
+    char* output;
+    size_t output_len;
+    uint16_t reg[RG_R7];        // R0-R6, R7 holds return addresses that moved
+    uint64_t data_hash;         // FNV-1a of memory outside the code
+};
+
+static void run(const uint16_t* words, const char* input, uint64_t limit, struct run_result* r) {
+    memset(memory, 0, sizeof(memory));
+    memcpy(memory + origin, words + origin, length * sizeof(uint16_t));
+    vm_reset(PC_START);
+
+    vm_in  = input ? fopen(input, "rb") : tmpfile();
+    vm_out = open_memstream(&r->output, &r->output_len);
+    if(!vm_in || !vm_out) {
+        fprintf(stderr, "tyvm-opt: cannot open input %s\n", input ? input : "(empty)");
+        exit(1);
+    }
+
+    r->status  = vm_run(limit);
+    r->retired = vm_retired;
+    fclose(vm_in);
+    fclose(vm_out);
+
+    memcpy(r->reg, reg, sizeof(r->reg));
+    r->data_hash = 0xCBF29CE484222325u;
+    for(uint32_t a = 0; a <= UINT16_MAX; ++a) {
+        if(in_image(a) && (flags[a] & AF_CODE)) continue;
+        r->data_hash = (r->data_hash ^ memory[a]) * 0x100000001B3u;
+    }
+}
+
+static int verify(const char* input, uint64_t limit) {
+    struct run_result a, b;
+    run(original, input, limit, &a);
+    run(image, input, limit, &b);
+
+    const char* name = input ? input : "(no input)";
+    int ok = TRUE;
+    if(a.status != VM_HALT) {
+        fprintf(stderr, "%s: original image did not halt within %lu instructions\n", name, (unsigned long)limit);
+        ok = FALSE;
+    } else if(b.status != VM_HALT) {
+        fprintf(stderr, "%s: optimized image did not halt\n", name);
+        ok = FALSE;
+    } else if(a.output_len != b.output_len || memcmp(a.output, b.output, a.output_len) != 0) {
+        fprintf(stderr, "%s: console output differs\n", name);
+        ok = FALSE;
+    } else if(memcmp(a.reg, b.reg, sizeof(a.reg)) != 0) {
+        fprintf(stderr, "%s: final registers differ\n", name);
+        ok = FALSE;
+    } else if(a.data_hash != b.data_hash) {
+        fprintf(stderr, "%s: final data memory differs\n", name);
+        ok = FALSE;
+    }
+
+    if(ok) fprintf(stderr, "%s: %lu -> %lu instructions\n", name, (unsigned long)a.retired, (unsigned long)b.retired);
+    free(a.output);
+    free(b.output);
+    return ok;
+}
+
+/* ---------- image files ---------- */
+
+/* Read the "indirect" and "load" lines of a value profile, ignore the rest */
+static int load_profile(const char* file) {
+    FILE* f = fopen(file, "r");
+    if(!f) return FALSE;
+
+    char line[1024];
+    while(fgets(line, sizeof(line), f)) {
+        unsigned at, val, lo, hi;
+        if(sscanf(line, "load x%x %*s hits %*u x%x from x%x-x%x", &at, &val, &lo, &hi) == 4) {
+            if(at <= UINT16_MAX) profile_loads[at] = (struct const_load){ (uint16_t)val, (uint16_t)lo, (uint16_t)hi, TRUE };
+            continue;
+        }
+        if(strncmp(line, "indirect ", 9) != 0) continue;
+
+        char* save;
+        strtok_r(line, " \n", &save);
+        const char* site = strtok_r(NULL, " \n", &save);
+        if(!site || site[0] != 'x') continue;
+        const uint16_t pc = (uint16_t)strtoul(site + 1, NULL, 16);
+
+        int complete = FALSE;
+        for(char* tok; (tok = strtok_r(NULL, " \n", &save)); ) {
+            if(strncmp(tok, "other:", 6) == 0) complete = strtoull(tok + 6, NULL, 10) == 0;
+            else if(tok[0] == 'x' && strchr(tok, ':') && profile_target_count <= UINT16_MAX)
+                profile_targets[profile_target_count++] = (uint16_t)strtoul(tok + 1, NULL, 16);
+        }
+        profiled_site[pc] = complete;
+    }
+    fclose(f);
+    return TRUE;
+}
+
+static int load(const char* file) {
+    FILE* f = fopen(file, "rb");
+    if(!f) return FALSE;
+
+    uint8_t be[2];
+    if(fread(be, 1, 2, f) != 2) {
+        fclose(f);
+        return FALSE;
+    }
+    origin = be[0] << 8 | be[1];
+
+    length = 0;
+    while(origin + length <= UINT16_MAX && fread(be, 1, 2, f) == 2)
+        original[origin + length++] = be[0] << 8 | be[1];
+    fclose(f);
+
+    memcpy(image, original, sizeof(image));
+    return length > 0;
+}
+
+static int save(const char* file) {
+    FILE* f = fopen(file, "wb");
+    if(!f) return FALSE;
+
+    putc(origin >> 8, f);
+    putc(origin & 0xFF, f);
+    for(uint32_t a = origin; a < origin + length; ++a) {
+        putc(image[a] >> 8, f);
+        putc(image[a] & 0xFF, f);
+    }
+    return fclose(f) == 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* inputs[MAX_INPUTS];
+    int input_count = 0;
+    const char* files[2];
+    int file_count = 0;
+    uint64_t limit = 100000000;
+    int assume_taken = FALSE;
+    const char* profile = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-i") == 0 && i + 1 < argc && input_count < MAX_INPUTS) inputs[input_count++] = argv[++i];
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) limit = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-a") == 0) assume_taken = TRUE;
+        else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc) profile = argv[++i];
+        else if(strcmp(argv[i], "-v") == 0) verbose = TRUE;
+        else if(file_count < 2) files[file_count++] = argv[i];
+    }
+
+    if(file_count != 2) {
+        printf("usage: %s [-a] [-p profile] [-i input]... [-n limit] [-v] in.obj out.obj\n", argv[0]);
+        exit(2);
+    }
+
+    if(!load(files[0])) {
+        printf("failed to load image: %s\n", files[0]);
+        exit(1);
+    }
+    if(!in_image(PC_START)) {
+        printf("image does not contain the start address x%04X\n", PC_START);
+        exit(1);
+    }
+
+    if(profile && !load_profile(profile)) {
+        printf("failed to read profile: %s\n", profile);
+        exit(1);
+    }
+
+    optimize(assume_taken);
+    fprintf(stderr, "threaded %u, inverted %u, removed %u in %u blocks\n", n_threaded, n_inverted, n_removed, n_packed);
+
+    int ok = TRUE;
+    if(input_count == 0) ok = verify(NULL, limit);
+    for(int i = 0; i < input_count; ++i) ok &= verify(inputs[i], limit);
+
+    if(!ok) {
+        fprintf(stderr, "not equivalent, %s not written\n", files[1]);
+        exit(1);
+    }
+
+    if(!save(files[1])) {
+        printf("failed to write image: %s\n", files[1]);
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+    tyvm-results: print a tyvm-run result stream as JSON or CSV.
+    Copyright (c) 2022 Erick Ahmed
+    Open-source software distributed under GNU GPL v.3 license
+
+    Usage:
+        tyvm-results [-f json|csv] [-a batch.tya] [-o] [-j job] results.tyr
+
+    Prints one JSON object per line (the default) or one CSV row per job,
+    in job order. -a adds the source names from the archive the batch ran,
+    -o adds each job's console output from results.tyr.blob, and -j prints
+    a single job, found through the index without reading the others.
+    A stream still being written has no index yet: its finished records
+    are printed in the order they were written.
+*/
+
+#include "preprocessor.h"
+#include "archive.h"
+#include "results.h"
+
+#include <sys/stat.h>
+
+enum format { F_JSON, F_CSV };
+
+static const char* exit_names[] = { "limit", "halt", "illegal", "error" };
+
+/* The whole file, read-only; NULL if it cannot be mapped */
+static const char* map_file(const char* path, size_t* size) {
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    const char* p = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void json_string(const char* s, size_t len) {
+    putchar('"');
+    for(size_t i = 0; i < len; ++i) {
+        const unsigned char c = s[i];
+        if(c == '"' || c == '\\') printf("\\%c", c);
+        else if(c == '\n') fputs("\\n", stdout);
+        else if(c < 0x20 || c >= 0x7F) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+static void csv_string(const char* s, size_t len) {
+    putchar('"');
+    for(size_t i = 0; i < len; ++i) {
+        if(s[i] == '"') putchar('"');
+        putchar(s[i]);
+    }
+    putchar('"');
+}
+
+/* Source name of a job, NULL without an archive */
+static const char* job_name(const struct tya_header* archive, size_t size, uint32_t job) {
+    if(!archive || job >= archive->count) return NULL;
+    const struct tya_entry* e = (const struct tya_entry*)(archive + 1) + job;
+    return archive->names_offset + e->name < size ? (const char*)archive + archive->names_offset + e->name : NULL;
+}
+
+/* One job; its output is printed when blob is given, empty if the blob is short */
+static void print_record(enum format format, const struct tyr_record* r, const char* name, const char* blob, size_t blob_size) {
+    const int has_output = r->output_offset + r->output_length <= blob_size;
+    const char* output   = blob && has_output ? blob + r->output_offset : "";
+    const size_t length  = blob && has_output ? r->output_length : 0;
+    const char* exit = exit_names[r->exit <= TYR_ERROR ? r->exit : TYR_ERROR];
+
+    if(format == F_JSON) {
+        printf("{\"job\":%u", r->job);
+        if(name) {
+            printf(",\"name\":");
+            json_string(name, strlen(name));
+        }
+        printf(",\"exit\":\"%s\",\"retired\":%lu,\"output_hash\":\"%016lx\",\"output_offset\":%lu,\"output_length\":%u",
+               exit, (unsigned long)r->retired, (unsigned long)r->output_hash, (unsigned long)r->output_offset, r->output_length);
+        if(blob) {
+            printf(",\"output\":");
+            json_string(output, length);
+        }
+        printf("}\n");
+        return;
+    }
+
+    printf("%u", r->job);
+    if(name) {
+        putchar(',');
+        csv_string(name, strlen(name));
+    }
+    printf(",%s,%lu,%016lx,%lu,%u", exit, (unsigned long)r->retired, (unsigned long)r->output_hash,
+           (unsigned long)r->output_offset, r->output_length);
+    if(blob) {
+        putchar(',');
+        csv_string(output, length);
+    }
+    putchar('\n');
+}
+
+int main(int argc, const char* argv[]) {
+    enum format format = F_JSON;
+    const char* batch = NULL;
+    const char* path = NULL;
+    int with_output = FALSE;
+    long job = -1;
+    int usage = FALSE;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            const char* f = argv[++i];
+            if(strcmp(f, "csv") == 0) format = F_CSV;
+            else if(strcmp(f, "json") == 0) format = F_JSON;
+            else usage = TRUE;
+        } else if(strcmp(argv[i], "-a") == 0 && i + 1 < argc) batch = argv[++i];
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) job = atol(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0) with_output = TRUE;
+        else path = argv[i];
+    }
+
+    if(!path || usage) {
+        printf("usage: %s [-f json|csv] [-a batch.tya] [-o] [-j job] results.tyr\n", argv[0]);
+        exit(2);
+    }
+
+    size_t size;
+    const char* stream = map_file(path, &size);
+    const struct tyr_header* h = (const struct tyr_header*)stream;
+    if(!stream || size < sizeof(*h) || h->magic != TYR_MAGIC || h->version != TYR_VERSION || h->record_size != sizeof(struct tyr_record)) {
+        fprintf(stderr, "tyvm-results: %s is not a result stream\n", path);
+        exit(1);
+    }
+    const struct tyr_record* records = (const struct tyr_record*)(h + 1);
+
+    /* a complete stream has its index; an unfinished one only whole records */
+    const uint32_t* index = NULL;
+    uint64_t record_count = (size - sizeof(*h)) / sizeof(struct tyr_record);
+    if(h->index_offset) {
+        if(h->index_offset + (uint64_t)h->jobs * sizeof(uint32_t) > size || h->records > record_count) {
+            fprintf(stderr, "tyvm-results: %s is truncated\n", path);
+            exit(1);
+        }
+        index = (const uint32_t*)(stream + h->index_offset);
+        record_count = h->records;
+    }
+
+    const char* blob = NULL;
+    size_t blob_size = 0;
+    if(with_output) {
+        char blob_path[4096];
+        snprintf(blob_path, sizeof(blob_path), "%s.blob", path);
+        blob = map_file(blob_path, &blob_size);
+        if(!blob) {
+            fprintf(stderr, "tyvm-results: cannot read %s\n", blob_path);
+            exit(1);
+        }
+    }
+
+    const struct tya_header* archive = NULL;
+    size_t archive_size = 0;
+    if(batch) {
+        archive = (const struct tya_header*)map_file(batch, &archive_size);
+        if(!archive || archive_size < sizeof(*archive) || archive->magic != TYA_MAGIC || archive->version != TYA_VERSION
+           || archive->count != h->jobs || archive->names_offset > archive_size) {
+            fprintf(stderr, "tyvm-results: %s is not the archive of this batch\n", batch);
+            exit(1);
+        }
+    }
+
+    if(format == F_CSV) printf("job%s,exit,retired,output_hash,output_offset,output_length%s\n",
+                               archive ? ",name" : "", with_output ? ",output" : "");
+
+    int printed = 0;
+    for(uint64_t i = 0; i < (index ? h->jobs : record_count); ++i) {
+        const struct tyr_record* r;
+        if(job >= 0) {                  // one job: straight through the index, or a scan without one
+            if(index) {
+                if((uint64_t)job >= h->jobs || index[job] >= record_count) break;
+                r = &records[index[job]];
+            } else if(records[i].job == job) r = &records[i];
+            else continue;
+        } else if(index) {
+            if(index[i] >= record_count) continue;      // TYR_NONE: the job died with its worker
+            r = &records[index[i]];
+        } else r = &records[i];
+
+        print_record(format, r, job_name(archive, archive_size, r->job), blob, blob_size);
+        printed++;
+        if(job >= 0) break;
+    }
+
+    if(job >= 0 && !printed) {
+        fprintf(stderr, "tyvm-results: no result for job %ld\n", job);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,320 @@
+/*
+    tyvm-run: run every image of a tyvm-as archive and stream the results.
+    Copyright (c) 2022 Erick Ahmed
+    Open-source software distributed under GNU GPL v.3 license
+
+    Usage:
+        tyvm-run [-j jobs] [-i input] [-n limit] -o results.tyr batch.tya
+
+    Every entry of the archive is one job: the image runs from x3000 on
+    the input file (-i, default none) until it halts or has executed
+    -n instructions (default 100 million). The results go to a binary
+    stream (see results.h) and the console output of every job to
+    results.tyr.blob; tyvm-results turns them into JSON or CSV.
+
+    Jobs run inside -j worker processes (default: one per usable core),
+    without an exec per job. A worker takes RUN_CHUNK jobs at a time and
+    sends their records and outputs down its pipe in one message. The
+    parent is the only writer: it appends each message to the two files
+    through large stdio buffers, so a batch costs a few writes per
+    thousand jobs, and builds the index by job number at the end.
+*/
+
+#include "preprocessor.h"
+#include "registers.h"
+#include "lc3_lib.h"
+#include "vm.h"
+#include "stats.h"
+#include "archive.h"
+#include "results.h"
+#include "numa.h"
+
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define RUN_CHUNK       64              // jobs per message
+#define RUN_BUFFER      (1 << 20)       // stdio buffer of each output file
+
+/* Header of a worker message, followed by the records and their outputs;
+record offsets are relative to the message */
+struct chunk {
+    uint32_t records;
+    uint32_t reserved;
+    uint64_t output_bytes;
+};
+
+static const struct tya_header* archive;
+static const struct tya_entry* entries;
+static atomic_uint* next_job;           // shared by the workers
+static const char* input;
+static uint64_t limit = 100000000u;
+
+static const char* exit_names[] = { "limit", "halt", "illegal", "error" };
+
+static int write_all(int fd, const void* buf, size_t len) {
+    for(size_t done = 0; done < len; ) {
+        const ssize_t n = write(fd, (const char*)buf + done, len - done);
+        if(n <= 0) return FALSE;
+        done += n;
+    }
+    return TRUE;
+}
+
+/* TRUE with len bytes, FALSE on a clean end of file before the first one */
+static int read_all(int fd, void* buf, size_t len, int* broken) {
+    size_t done = 0;
+    while(done < len) {
+        const ssize_t n = read(fd, (char*)buf + done, len - done);
+        if(n <= 0) {
+            if(done > 0 || n < 0) *broken = TRUE;
+            return FALSE;
+        }
+        done += n;
+    }
+    return TRUE;
+}
+
+/* Run job i with its output going to vm_out */
+static void run_job(unsigned i, struct tyr_record* r) {
+    const struct tya_entry* e = &entries[i];
+    memset(r, 0, sizeof(*r));
+    r->job = i;
+
+    if(e->status != TYA_OK || e->length < 2) {
+        r->exit = TYR_ERROR;
+        return;
+    }
+
+    const uint16_t* image = (const uint16_t*)((const char*)archive + e->offset);
+    const uint16_t origin = swap16(image[0]);
+    size_t words = e->length / 2 - 1;
+    if(words > (size_t)(UINT16_MAX - origin)) words = UINT16_MAX - origin;      // as read_image_file
+
+    memset(memory, 0, sizeof(memory));
+    for(size_t w = 0; w < words; ++w) memory[origin + w] = swap16(image[w + 1]);
+    vm_reset(PC_START);
+    rewind(vm_in);
+
+    r->exit          = vm_run(limit);
+    r->retired       = vm_retired;
+    r->output_hash   = vm_out_hash;
+    r->output_length = (uint32_t)vm_out_len;
+}
+
+static int worker(int w, int fd, const struct numa_topology* topo) {
+    if(topo->nodes > 1) numa_pin(numa_worker_cpu(topo, w));
+
+    vm_in = fopen(input ? input : "/dev/null", "rb");
+    if(!vm_in) return FALSE;
+
+    struct tyr_record records[RUN_CHUNK];
+    for(;;) {
+        const unsigned first = atomic_fetch_add(next_job, RUN_CHUNK);
+        if(first >= archive->count) break;
+        const unsigned last = archive->count - first < RUN_CHUNK ? archive->count : first + RUN_CHUNK;
+
+        char* output = NULL;
+        size_t output_len = 0;
+        vm_out = open_memstream(&output, &output_len);
+        if(!vm_out) return FALSE;
+
+        uint64_t offset = 0;
+        for(unsigned i = first; i < last; ++i) {
+            struct tyr_record* r = &records[i - first];
+            run_job(i, r);
+            r->output_offset = offset;
+            offset += r->output_length;
+        }
+        fclose(vm_out);
+
+        const struct chunk c = { .records = last - first, .output_bytes = output_len };
+        const int ok = write_all(fd, &c, sizeof(c)) && write_all(fd, records, c.records * sizeof(*records))
+                       && write_all(fd, output, output_len);
+        free(output);
+        if(!ok) return FALSE;
+    }
+    return TRUE;
+}
+
+static const void* map_archive(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct tya_header)) return NULL;
+
+    const struct tya_header* h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(h == MAP_FAILED) return NULL;
+
+    if(h->magic != TYA_MAGIC || h->version != TYA_VERSION
+       || sizeof(*h) + (uint64_t)h->count * sizeof(struct tya_entry) > (uint64_t)st.st_size) return NULL;
+    const struct tya_entry* e = (const struct tya_entry*)(h + 1);
+    for(uint32_t i = 0; i < h->count; ++i)
+        if(e[i].offset > (uint64_t)st.st_size || e[i].length > st.st_size - e[i].offset) return NULL;
+    return h;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* out = NULL;
+    const char* batch = NULL;
+    struct numa_topology topo;
+    int workers = numa_topology(&topo) ? topo.cpus : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) out = argv[++i];
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) workers = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) input = argv[++i];
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) limit = strtoull(argv[++i], NULL, 10);
+        else batch = argv[i];
+    }
+
+    if(!out || !batch || limit == 0) {
+        printf("usage: %s [-j jobs] [-i input] [-n limit] -o results.tyr batch.tya\n", argv[0]);
+        exit(2);
+    }
+
+    archive = map_archive(batch);
+    if(!archive) {
+        fprintf(stderr, "tyvm-run: %s is not a readable archive\n", batch);
+        exit(1);
+    }
+    entries = (const struct tya_entry*)(archive + 1);
+    if(input && access(input, R_OK) != 0) {
+        fprintf(stderr, "tyvm-run: cannot read %s\n", input);
+        exit(1);
+    }
+
+    char blob_path[4096];
+    snprintf(blob_path, sizeof(blob_path), "%s.blob", out);
+    FILE* stream = fopen(out, "wb");
+    FILE* blob   = fopen(blob_path, "wb");
+    if(!stream || !blob) {
+        fprintf(stderr, "tyvm-run: cannot write %s\n", stream ? blob_path : out);
+        exit(1);
+    }
+    setvbuf(stream, NULL, _IOFBF, RUN_BUFFER);
+    setvbuf(blob, NULL, _IOFBF, RUN_BUFFER);
+
+    struct tyr_header header = {
+        .magic       = TYR_MAGIC,
+        .version     = TYR_VERSION,
+        .record_size = sizeof(struct tyr_record),
+        .jobs        = archive->count
+    };
+    fwrite(&header, sizeof(header), 1, stream);
+
+    uint32_t* index = malloc(archive->count * sizeof(uint32_t) + 1);
+    if(!index) {
+        fprintf(stderr, "tyvm-run: out of memory\n");
+        exit(1);
+    }
+    for(uint32_t j = 0; j < archive->count; ++j) index[j] = TYR_NONE;
+
+    next_job = mmap(NULL, sizeof(*next_job), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(next_job == MAP_FAILED) return 1;
+    atomic_init(next_job, 0);
+
+    if(workers < 1) workers = 1;
+    if((unsigned)workers > (archive->count + RUN_CHUNK - 1) / RUN_CHUNK) workers = (archive->count + RUN_CHUNK - 1) / RUN_CHUNK;
+
+    const uint64_t start = stats_now_ns();
+    struct pollfd* pipes = calloc(workers > 0 ? workers : 1, sizeof(*pipes));
+    if(!pipes) {
+        fprintf(stderr, "tyvm-run: out of memory\n");
+        exit(1);
+    }
+    int open_pipes = 0;
+    for(int w = 0; w < workers; ++w) {
+        int fds[2];
+        if(pipe(fds) != 0) break;
+        pid_t pid = fork();
+        if(pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            break;
+        }
+        if(pid == 0) {
+            for(int p = 0; p < open_pipes; ++p) close(pipes[p].fd);
+            close(fds[0]);
+            _exit(worker(w, fds[1], &topo) ? 0 : 1);
+        }
+        close(fds[1]);
+        pipes[open_pipes].fd = fds[0];
+        pipes[open_pipes++].events = POLLIN;
+    }
+
+    uint64_t blob_offset = 0;
+    uint64_t exits[TYR_ERROR + 1] = {0};
+    char* output = NULL;
+    size_t output_cap = 0;
+    int failed = FALSE;
+
+    for(int live = open_pipes; live > 0; ) {
+        if(poll(pipes, open_pipes, -1) < 0) continue;
+
+        for(int p = 0; p < open_pipes; ++p) {
+            if(pipes[p].fd < 0 || !pipes[p].revents) continue;
+
+            struct chunk c;
+            struct tyr_record records[RUN_CHUNK];
+            int broken = FALSE;
+            const int more = read_all(pipes[p].fd, &c, sizeof(c), &broken);     // FALSE: the worker is done
+            if(!more || c.records > RUN_CHUNK || !read_all(pipes[p].fd, records, c.records * sizeof(*records), &broken)) {
+                failed |= broken || (more && c.records > RUN_CHUNK);
+                close(pipes[p].fd);
+                pipes[p].fd = -1;
+                live--;
+                continue;
+            }
+            if(c.output_bytes > output_cap) {
+                char* grown = realloc(output, c.output_bytes);
+                if(grown) {
+                    output = grown;
+                    output_cap = c.output_bytes;
+                }
+            }
+            /* with no room for the output, the chunk is lost like a dead worker's */
+            if(c.output_bytes > output_cap || !read_all(pipes[p].fd, output, c.output_bytes, &broken)) {
+                failed = TRUE;
+                close(pipes[p].fd);
+                pipes[p].fd = -1;
+                live--;
+                continue;
+            }
+
+            fwrite(output, 1, c.output_bytes, blob);
+            for(uint32_t r = 0; r < c.records; ++r) {
+                records[r].output_offset += blob_offset;
+                if(records[r].job < archive->count) index[records[r].job] = (uint32_t)header.records;
+                exits[records[r].exit <= TYR_ERROR ? records[r].exit : TYR_ERROR]++;
+                header.records++;
+            }
+            fwrite(records, sizeof(*records), c.records, stream);
+            blob_offset += c.output_bytes;
+        }
+    }
+
+    int status;
+    while(wait(&status) > 0) failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    failed |= header.records != archive->count;
+
+    header.index_offset = sizeof(header) + header.records * sizeof(struct tyr_record);
+    fwrite(index, sizeof(uint32_t), archive->count, stream);
+    fseek(stream, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, stream);
+    if(fclose(stream) != 0 || fclose(blob) != 0) {
+        fprintf(stderr, "tyvm-run: cannot write %s\n", out);
+        return 1;
+    }
+
+    const double seconds = (stats_now_ns() - start) / 1e9;
+    printf("%u jobs in %.2f s (%.0f jobs/s):", archive->count, seconds, seconds > 0 ? archive->count / seconds : 0.0);
+    for(int e = TYR_LIMIT; e <= TYR_ERROR; ++e) printf(" %lu %s", (unsigned long)exits[e], exit_names[e]);
+    printf("\n");
+    if(failed) {
+        fprintf(stderr, "tyvm-run: %lu of %u jobs have no result\n", (unsigned long)(archive->count - header.records), archive->count);
+        return 1;
+    }
+    return 0;
+}
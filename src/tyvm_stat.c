@@ -0,0 +1,240 @@
+/*
+    tyvm-stat: read the live counters of running tyvm instances.
+    Copyright (c) 2022 Erick Ahmed
+    Open-source software distributed under GNU GPL v.3 license
+
+    Usage:
+        tyvm-stat name...                   print Prometheus text once
+        tyvm-stat -s socket name...         serve it on a Unix socket
+
+    Each name is the TYVM_STATS value a VM was started with. The pages are
+    mapped read-only, so a monitor can never disturb the guest.
+*/
+
+#include "preprocessor.h"
+#include "stats.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define STAT_CLIENT_TIMEOUT 1       // seconds a scraper gets to send its request and read the answer
+
+#define MAX_VMS 256
+
+static const char* opcode_names[16] = {
+    "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+};
+
+static const char* trap_names[6] = { "GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT" };
+
+static const char* state_names[4] = { "loading", "running", "waiting", "halted" };
+
+struct vm_page {
+    const char* name;
+    const volatile struct vm_stats* s;
+};
+
+static struct vm_page vms[MAX_VMS];
+static int vm_count;
+
+/* Map one stats page read-only, NULL if it does not exist or is not ours */
+static const volatile struct vm_stats* map_stats(const char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    int fd = shm_open(path, O_RDONLY, 0);
+    if(fd < 0) return NULL;
+
+    void* page = mmap(NULL, sizeof(struct vm_stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(page == MAP_FAILED) return NULL;
+
+    const volatile struct vm_stats* s = page;
+    if(s->magic != STATS_MAGIC || s->version != STATS_VERSION) {
+        munmap(page, sizeof(struct vm_stats));
+        return NULL;
+    }
+    return s;
+}
+
+/* (Re)map every page: a VM restarted under the same name gets a new object */
+static void remap_all(void) {
+    for(int i = 0; i < vm_count; ++i) {
+        if(vms[i].s) munmap((void*)vms[i].s, sizeof(struct vm_stats));
+        vms[i].s = map_stats(vms[i].name);
+    }
+}
+
+/* Write the Prometheus text exposition of every mapped VM */
+static void write_metrics(FILE* out) {
+    const uint64_t now = stats_now_ns();
+
+    fprintf(out, "# HELP tyvm_up Whether the stats page of the VM could be mapped.\n# TYPE tyvm_up gauge\n");
+    for(int i = 0; i < vm_count; ++i)
+        fprintf(out, "tyvm_up{vm=\"%s\"} %d\n", vms[i].name, vms[i].s != NULL);
+
+    fprintf(out, "# HELP tyvm_state Current state of the VM.\n# TYPE tyvm_state gauge\n");
+    for(int i = 0; i < vm_count; ++i) {
+        if(!vms[i].s) continue;
+        for(int st = VS_LOADING; st <= VS_HALTED; ++st)
+            fprintf(out, "tyvm_state{vm=\"%s\",state=\"%s\"} %d\n", vms[i].name, state_names[st], vms[i].s->state == (uint64_t)st);
+    }
+
+    fprintf(out, "# HELP tyvm_uptime_seconds Time since the VM started.\n# TYPE tyvm_uptime_seconds gauge\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_uptime_seconds{vm=\"%s\"} %.3f\n", vms[i].name, (now - vms[i].s->start_ns) / 1e9);
+
+    fprintf(out, "# HELP tyvm_instructions_total Retired guest instructions.\n# TYPE tyvm_instructions_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_instructions_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)stats_instructions(vms[i].s));
+
+    fprintf(out, "# HELP tyvm_mips Average guest MIPS since the VM started.\n# TYPE tyvm_mips gauge\n");
+    for(int i = 0; i < vm_count; ++i) {
+        if(!vms[i].s) continue;
+        double elapsed = (now - vms[i].s->start_ns) / 1e9;
+        fprintf(out, "tyvm_mips{vm=\"%s\"} %.3f\n", vms[i].name, elapsed > 0 ? stats_instructions(vms[i].s) / elapsed / 1e6 : 0.0);
+    }
+
+    fprintf(out, "# HELP tyvm_opcode_total Retired guest instructions by opcode.\n# TYPE tyvm_opcode_total counter\n");
+    for(int i = 0; i < vm_count; ++i) {
+        if(!vms[i].s) continue;
+        for(int op = 0; op < 16; ++op)
+            fprintf(out, "tyvm_opcode_total{vm=\"%s\",op=\"%s\"} %lu\n", vms[i].name, opcode_names[op], (unsigned long)vms[i].s->opcodes[op]);
+    }
+
+    fprintf(out, "# HELP tyvm_trap_total Executed trap routines.\n# TYPE tyvm_trap_total counter\n");
+    for(int i = 0; i < vm_count; ++i) {
+        if(!vms[i].s) continue;
+        for(int t = 0; t < 6; ++t)
+            fprintf(out, "tyvm_trap_total{vm=\"%s\",trap=\"%s\"} %lu\n", vms[i].name, trap_names[t], (unsigned long)vms[i].s->traps[t]);
+    }
+
+    fprintf(out, "# HELP tyvm_mem_reads_total Guest memory reads, including instruction fetches.\n# TYPE tyvm_mem_reads_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_mem_reads_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->mem_reads);
+
+    fprintf(out, "# HELP tyvm_mem_writes_total Guest memory writes.\n# TYPE tyvm_mem_writes_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_mem_writes_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->mem_writes);
+
+    fprintf(out, "# HELP tyvm_kbd_polls_total Reads of the keyboard status register.\n# TYPE tyvm_kbd_polls_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_kbd_polls_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->kbd_polls);
+
+    fprintf(out, "# HELP tyvm_kbd_hits_total Keyboard status reads that found a key ready.\n# TYPE tyvm_kbd_hits_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_kbd_hits_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->kbd_hits);
+
+    fprintf(out, "# HELP tyvm_input_wait_seconds Time blocked in GETC/IN waiting for input.\n# TYPE tyvm_input_wait_seconds histogram\n");
+    for(int i = 0; i < vm_count; ++i) {
+        if(!vms[i].s) continue;
+        uint64_t cumulative = 0;
+        for(int b = 0; b < STATS_HIST_BUCKETS - 1; ++b) {
+            cumulative += vms[i].s->input_wait_hist[b];
+            fprintf(out, "tyvm_input_wait_seconds_bucket{vm=\"%s\",le=\"%g\"} %lu\n", vms[i].name, (double)(1ul << b) / 1e6, (unsigned long)cumulative);
+        }
+        fprintf(out, "tyvm_input_wait_seconds_bucket{vm=\"%s\",le=\"+Inf\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->input_waits);
+        fprintf(out, "tyvm_input_wait_seconds_sum{vm=\"%s\"} %.6f\n", vms[i].name, vms[i].s->input_wait_ns / 1e9);
+        fprintf(out, "tyvm_input_wait_seconds_count{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->input_waits);
+    }
+
+    fprintf(out, "# HELP tyvm_pace_hz Target guest clock rate, 0 when running flat out.\n# TYPE tyvm_pace_hz gauge\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_pace_hz{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->pace_hz);
+
+    fprintf(out, "# HELP tyvm_pace_overruns_total Paced slices that ended past their deadline.\n# TYPE tyvm_pace_overruns_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_pace_overruns_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->pace_overruns);
+
+    fprintf(out, "# HELP tyvm_pace_late_seconds How late paced sleeps woke up.\n# TYPE tyvm_pace_late_seconds histogram\n");
+    for(int i = 0; i < vm_count; ++i) {
+        if(!vms[i].s) continue;
+        uint64_t cumulative = 0;
+        for(int b = 0; b < STATS_HIST_BUCKETS - 1; ++b) {
+            cumulative += vms[i].s->pace_late_hist[b];
+            fprintf(out, "tyvm_pace_late_seconds_bucket{vm=\"%s\",le=\"%g\"} %lu\n", vms[i].name, (double)(1ul << b) / 1e6, (unsigned long)cumulative);
+        }
+        fprintf(out, "tyvm_pace_late_seconds_bucket{vm=\"%s\",le=\"+Inf\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->pace_sleeps);
+        fprintf(out, "tyvm_pace_late_seconds_sum{vm=\"%s\"} %.6f\n", vms[i].name, vms[i].s->pace_late_ns / 1e9);
+        fprintf(out, "tyvm_pace_late_seconds_count{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->pace_sleeps);
+    }
+
+    fprintf(out, "# HELP tyvm_idle_tier How much of a waiting VM is resident: 0 all, 1 packed, 2 hibernated.\n# TYPE tyvm_idle_tier gauge\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_idle_tier{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->idle_tier);
+
+    fprintf(out, "# HELP tyvm_idle_packs_total Times a waiting VM compressed its pages.\n# TYPE tyvm_idle_packs_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_idle_packs_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->idle_packs);
+
+    fprintf(out, "# HELP tyvm_idle_hibernations_total Times a waiting VM moved its pages to a file.\n# TYPE tyvm_idle_hibernations_total counter\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_idle_hibernations_total{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->idle_hibernations);
+
+    fprintf(out, "# HELP tyvm_idle_packed_bytes Size of the last compressed state.\n# TYPE tyvm_idle_packed_bytes gauge\n");
+    for(int i = 0; i < vm_count; ++i)
+        if(vms[i].s) fprintf(out, "tyvm_idle_packed_bytes{vm=\"%s\"} %lu\n", vms[i].name, (unsigned long)vms[i].s->idle_packed_bytes);
+}
+
+/* Answer every connection with a minimal HTTP response, so
+`curl --unix-socket` and socket-aware scrapers work unchanged */
+static int serve(const char* path) {
+    int srv = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(srv < 0) return 1;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if(bind(srv, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(srv, 16) != 0) {
+        fprintf(stderr, "tyvm-stat: cannot listen on %s\n", path);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    for(;;) {
+        int fd = accept(srv, NULL, NULL);
+        if(fd < 0) continue;
+
+        /* one connection at a time: a client that stalls must not hold up the others */
+        const struct timeval timeout = { .tv_sec = STAT_CLIENT_TIMEOUT };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        char request[1024];
+        read(fd, request, sizeof(request));     // the request itself does not matter
+
+        remap_all();
+
+        char* body = NULL;
+        size_t len = 0;
+        FILE* out = open_memstream(&body, &len);
+        write_metrics(out);
+        fclose(out);
+
+        dprintf(fd, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+        write(fd, body, len);
+        free(body);
+        close(fd);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const char* socket_path = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) socket_path = argv[++i];
+        else if(vm_count < MAX_VMS) vms[vm_count++].name = argv[i];
+    }
+
+    if(vm_count == 0) {
+        printf("usage: %s [-s socket] name...\n", argv[0]);
+        exit(2);
+    }
+
+    if(socket_path) return serve(socket_path);
+
+    remap_all();
+    write_metrics(stdout);
+    return 0;
+}
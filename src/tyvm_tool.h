@@ -0,0 +1,50 @@
+/* Instrumentation API for tyvm tools
+
+A tool is a shared object listed in TYVM_TOOLS (colon separated, each
+entry optionally followed by =args). It exports tyvm_tool_init(), which
+fills in the callbacks it wants and leaves the rest NULL. The VM only
+pays for the events some tool asked for: with no tools loaded the
+interpreter loop does one extra flag test per instruction.
+
+Build a tool with:
+    gcc -shared -fPIC -o mytool.so mytool.c
+
+Control events (branch, trap, block) are reported after the instruction
+executed, so reg[RG_PC] is already the next PC and a trap's results are
+visible. */
+
+#ifndef TYVM_TOOL_H
+#define TYVM_TOOL_H
+
+#include <stdint.h>
+
+#define TYVM_TOOL_API 1
+
+struct tyvm_tool {
+    /* filled in by the VM before tyvm_tool_init() */
+    int api;                    // TYVM_TOOL_API of the VM
+    const char* args;           // text after '=' in TYVM_TOOLS, "" if none
+    uint16_t* memory;           // guest memory, 65536 words
+    uint16_t* reg;              // R0-R7, PC, COND (enum registers order)
+
+    /* filled in by the tool */
+    void* data;
+
+    /* on_insn and on_block only fire for PCs in [pc_lo, pc_hi], which
+    default to the whole address space */
+    uint16_t pc_lo;
+    uint16_t pc_hi;
+
+    void (*on_block)(struct tyvm_tool* tool, uint16_t pc);
+    void (*on_insn)(struct tyvm_tool* tool, uint16_t pc, uint16_t instr);
+    void (*on_mem_read)(struct tyvm_tool* tool, uint16_t address, uint16_t val);
+    void (*on_mem_write)(struct tyvm_tool* tool, uint16_t address, uint16_t val);
+    void (*on_branch)(struct tyvm_tool* tool, uint16_t pc, uint16_t target, int taken);
+    void (*on_trap)(struct tyvm_tool* tool, uint16_t pc, uint8_t trapvect);
+    void (*on_exit)(struct tyvm_tool* tool);
+};
+
+/* Exported by every tool, return 0 to refuse loading */
+int tyvm_tool_init(struct tyvm_tool* tool);
+
+#endif
@@ -0,0 +1,312 @@
+#include "preprocessor.h"
+#include "registers.h"
+#include "lc3_lib.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "instrument.h"
+#include "idle.h"
+#include "vm.h"
+
+uint64_t vm_retired;
+
+void vm_reset(uint16_t pc) {
+    memset(reg, 0, sizeof(reg));
+    reg[RG_COND] = FL_Z;
+    reg[RG_PC]   = pc;
+    vm_retired   = 0;
+    vm_out_len   = 0;
+    vm_out_hash  = 0xCBF29CE484222325u;
+}
+
+void vm_save(struct vm_state* s) {
+    memcpy(s->memory, memory, sizeof(memory));
+    memcpy(s->reg, reg, sizeof(reg));
+    s->retired = vm_retired;
+}
+
+void vm_load(const struct vm_state* s) {
+    memcpy(memory, s->memory, sizeof(memory));
+    memcpy(reg, s->reg, sizeof(reg));
+    vm_retired = s->retired;
+}
+
+uint64_t vm_hash(void) {
+    uint64_t h = 0xCBF29CE484222325u;
+    for(int r = 0; r < RG_COUNT; ++r) h = (h ^ reg[r]) * 0x100000001B3u;
+    for(uint32_t a = 0; a <= UINT16_MAX; ++a) h = (h ^ memory[a]) * 0x100000001B3u;
+    return h;
+}
+
+/* The interpreter loop is built once per x86-64 level and the loader
+picks the best one for the host CPU at startup */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && !defined(TYVM_NO_CLONES)
+#define VM_CLONES __attribute__((target_clones("default", "arch=x86-64-v2", "arch=x86-64-v3")))
+#else
+#define VM_CLONES
+#endif
+
+#define IN_PROMPT "Enter a character: "
+
+/* A timer stopped the VM while GETC or IN waited. The trap never took
+place: its counts are taken back and PC points at it again, so the run
+ends as if it had stopped just before. Only an on_insn tool has seen it. */
+static enum vm_exit trap_parked(uint16_t pc, uint16_t instr) {
+    stats->opcodes[OP_TRAP]--;
+    stats->traps[(instr & 0xFF) - TC_GETC]--;
+    stats->state = VS_RUNNING;
+    reg[RG_PC]   = pc;
+    return VM_LIMIT;
+}
+
+VM_CLONES enum vm_exit vm_run(uint64_t limit) {
+    if(!vm_in)  vm_in  = stdin;
+    if(!vm_out) vm_out = stdout;
+
+    enum vm_exit status = VM_LIMIT;
+    uint64_t executed = 0;
+
+    int running = TRUE;
+    while(running && executed++ < limit) {
+        const uint16_t pc    = reg[RG_PC];
+        const uint16_t instr = mem_fetch(reg[RG_PC]++);
+        const uint16_t op    = instr >> 12;
+
+        stats->opcodes[op]++;
+        if(instrument_mask & HOOK_INSN) instrument_insn(pc, instr);
+
+        static uint16_t cond;   // condition flag status
+        static uint16_t PCoffset9;     // 9-bit value that indicates where to load the address when added to PC register
+        static uint16_t PCoffset11;    // 11-bit value that indicates where to load the address when added to PC register
+        static uint16_t dr;            // destination register
+        static uint16_t sr;            // source register
+        static uint16_t sr1;           // source register 1
+        static uint16_t sr2;           // source register 2
+        static uint16_t imm_flag;      // immediate mode flag (bit[5])
+        static uint16_t imm5;          // immediate mode 5 bit value
+        static uint16_t jsr_flag;      // JSR flag
+        static uint16_t BaseR;
+        static uint16_t offset6;       // 6-bit offset value
+
+        static uint16_t* stringPnt;
+        static uint16_t* ch;
+        static uint64_t wait_start;    // start of a blocking input read
+        static int c;
+
+        switch (op) {
+            case OP_BR:
+                cond      = (instr >> 9) & 0x7;
+                PCoffset9 = sign_extend(instr & 0x1FF, 9);
+
+                if(cond & reg[RG_COND]) reg[RG_PC] += PCoffset9;
+
+                break;
+            case OP_ADD:
+                dr       = (instr >> 9) & 0x7;
+                sr1      = (instr >> 6) & 0x7;
+                imm_flag = (instr >> 5) & 0x1;
+
+                if(imm_flag == 0) {
+                    sr2 = (instr & 0x7);
+                    reg[dr] = reg[sr1] + reg[sr2];       // register mode add
+                } else {
+                    imm5 = sign_extend(instr & 0x1F, 5);
+                    reg[dr] = reg[sr1] + imm5;           // immediate mode add
+                }
+
+                update_flags(dr);
+
+                break;
+            case OP_LD:
+                dr        = (instr >> 9) & 0x7;
+                PCoffset9 = sign_extend(instr & 0x1FF, 9);
+
+                reg[dr] = mem_read(PCoffset9 + reg[RG_PC]);
+
+                update_flags(dr);
+
+                break;
+            case OP_ST:
+                sr        = (instr >> 9) & 0x7;
+                PCoffset9 = sign_extend(instr & 0x1FF, 9);     // 9-bit value that indicates where to load the address when added to RG_PC
+
+                mem_write(PCoffset9 + reg[RG_PC], reg[sr]);
+
+                break;
+            case OP_JSR:
+                PCoffset11  = sign_extend(instr & 0x7FF, 11);
+                jsr_flag    = (instr >> 11) & 0x1;
+                BaseR       = (instr >> 6) & 0x7;          // JSRR only ecoding
+
+                sr = reg[BaseR];                           // read before R7 is overwritten by JSRR R7
+                reg[RG_R7] = reg[RG_PC];                   // return address
+
+                if(jsr_flag == 0) reg[RG_PC] = sr;                  // JSRR
+                else reg[RG_PC] += PCoffset11;                      // JSR
+
+                break;
+            case OP_AND:
+                dr       = (instr >> 9) & 0x7;
+                sr1      = (instr >> 6) & 0x7;
+                imm_flag = (instr >> 5) & 0x1;
+
+                if(imm_flag == 0) {
+                    sr2 = (instr & 0x7);
+                    reg[dr] = reg[sr1] & reg[sr2];       // register mode and
+                } else {
+                    imm5 = sign_extend(instr & 0x1F, 5);
+                    reg[dr] = reg[sr1] & imm5;           // immediate mode and
+                }
+
+                update_flags(dr);
+
+                break;
+            case OP_LDR:
+                dr      = (instr >> 9) & 0x7;
+                BaseR   = (instr >> 6) & 0x7;
+                offset6 = sign_extend(instr & 0x3F, 6);
+
+                reg[dr] = mem_read(reg[BaseR] + offset6);
+
+                update_flags(dr);
+
+                break;
+            case OP_STR:
+                sr      = (instr >> 9) & 0x7;
+                BaseR   = (instr >> 6) & 0x7;
+                offset6 = sign_extend(instr & 0x3F, 6);
+
+                mem_write(reg[BaseR] + offset6, reg[sr]);
+
+                break;
+            case OP_NOT:
+                dr = (instr >> 9) & 0x7;   // destination register
+                sr = (instr >> 6) & 0x7;   // source register
+
+                reg[dr] = ~(reg[sr]);
+
+                update_flags(dr);
+
+                break;
+            case OP_LDI:
+                dr        = (instr >> 9) & 0x7;
+                PCoffset9 = sign_extend(instr & 0x1FF, 9);
+
+                reg[dr] = mem_read(mem_read(PCoffset9 + reg[RG_PC]));
+
+                update_flags(dr);
+
+                break;
+            case OP_STI:
+                sr        = (instr >> 9) & 0x7;
+                PCoffset9 = sign_extend(instr & 0x1FF, 9);     // 9-bit value that indicates where to load the address when added to RG_PC
+
+                mem_write(mem_read(PCoffset9 + reg[RG_PC]), reg[sr]);
+
+                break;
+            case OP_JMP:
+                BaseR = (instr >> 6) & 0x7;
+
+                reg[RG_PC] = reg[BaseR];
+
+                break;
+            case OP_LEA:
+                dr = (instr >> 9) & 0x7;
+                PCoffset9 = sign_extend(instr & 0x1FF, 9);
+
+                reg[dr] = reg[RG_PC] + PCoffset9;
+
+                update_flags(dr);
+
+                break;
+            case OP_TRAP:
+                if((instr & 0xFF) >= TC_GETC && (instr & 0xFF) <= TC_HALT) stats->traps[(instr & 0xFF) - TC_GETC]++;
+
+                switch(instr & 0xFF) {
+                    case TC_GETC:
+                        fflush(vm_out);
+                        stats->state = VS_WAITING;
+                        wait_start = stats_now_ns();
+                        if(!idle_wait()) return trap_parked(pc, instr);     // stopped by a timer
+                        reg[RG_R0] = (uint16_t)vm_getc();
+                        stats_input_wait(stats_now_ns() - wait_start);
+                        stats->state = VS_RUNNING;
+                        break;
+                    case TC_OUT:
+                        vm_putc((char)reg[RG_R0]);
+                        fflush(vm_out);
+                        break;
+                    case TC_PUTS:
+                        stringPnt = memory + reg[RG_R0];
+
+                        while (*stringPnt) {
+                            vm_putc((char)*stringPnt);
+                            ++stringPnt;
+                        }
+                        fflush(vm_out);
+
+                        break;
+                    case TC_IN:
+                        fputs(IN_PROMPT, vm_out);      // shown while waiting, counted once the read happens
+                        fflush(vm_out);
+
+                        stats->state = VS_WAITING;
+                        wait_start = stats_now_ns();
+                        if(!idle_wait()) return trap_parked(pc, instr);
+                        vm_count_out(IN_PROMPT);
+                        c = vm_getc();
+                        stats_input_wait(stats_now_ns() - wait_start);
+                        stats->state = VS_RUNNING;
+
+                        vm_putc((char)c);
+                        fflush(vm_out);
+
+                        reg[RG_R0] = (uint16_t)c;
+                        update_flags(RG_R0);
+
+                        break;
+                    case TC_PUTSP:
+                        ch = memory + reg[RG_R0];
+                        while (*ch) {
+                            char char1 = (*ch) & 0xFF;
+                            vm_putc(char1);
+                            char char2 = (*ch) >> 8;
+                            if (char2) vm_putc(char2);
+                            ++ch;
+                        }
+                        fflush(vm_out);
+
+                        break;
+                    case TC_HALT:
+                        vm_puts("HALT\n");
+                        fflush(vm_out);
+                        running = FALSE;
+                        status  = VM_HALT;
+
+                        break;
+                    default:
+                        running = FALSE;
+                        status  = VM_ILLEGAL;
+                        break;
+                }
+
+                reg[RG_R7] = reg[RG_PC];    // last: a trap a timer stopped leaves R7 alone
+                break;
+            case OP_RES:    // reserved
+            case OP_RTI:    // unused
+            default:
+                running = FALSE;
+                status  = VM_ILLEGAL;
+                break;
+        }
+
+        vm_retired++;
+
+        if((1 << op) & BLOCK_END_OPS) {
+            block_hits[reg[RG_PC]]++;
+            if(instrument_mask) instrument_control(pc, instr);
+            if(snapshot_pending) take_snapshot();
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,42 @@
+/* The interpreter loop, usable by tyvm and by tools that drive the VM */
+
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+
+#include "registers.h"
+
+#define PC_START 0x3000     // default load and start address
+
+/* Why vm_run() returned */
+enum vm_exit {
+    VM_LIMIT = 0,           // ran the requested number of instructions
+    VM_HALT,                // guest executed TRAP x25
+    VM_ILLEGAL              // reserved opcode, RTI or unknown trap, PC points past it
+};
+
+/* Complete guest state, for checkpoints and context switches between VMs */
+struct vm_state {
+    uint16_t memory[UINT16_MAX + 1];
+    uint16_t reg[RG_COUNT];
+    uint64_t retired;
+};
+
+/* Instructions retired since the last vm_reset() */
+extern uint64_t vm_retired;
+
+/* Registers cleared, COND = Z, PC = pc, retired count and output hash zeroed */
+void vm_reset(uint16_t pc);
+
+/* Execute at most limit instructions */
+enum vm_exit vm_run(uint64_t limit);
+
+/* Copy the guest state out of / into the VM */
+void vm_save(struct vm_state* s);
+void vm_load(const struct vm_state* s);
+
+/* FNV-1a hash of registers and memory */
+uint64_t vm_hash(void);
+
+#endif